@@ -0,0 +1,165 @@
+
+/** @file kernel_bench.cpp */
+#include <chrono>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// Local
+#include "ConversionKernels.h"
+
+/*
+ * Times the copy of one (readout, view) matrix per slice and channel into
+ * a k-space volume, the way the converter's P-file paths did it before
+ * and with the kernels of ConversionKernels.h.
+ *
+ * The generic loop reads k-space as float, so integer samples are first
+ * converted to a float matrix, and then copies sample by sample through
+ * 2D and 4D index operators. The kernels read the stored sample type and
+ * copy contiguous blocks.
+ *
+ * usage: kernel_bench [readout] [views] [slices x channels] [repeats]
+ */
+
+namespace {
+
+  /** Stand-in for a strided Orchestra matrix */
+  template <typename T>
+    struct Matrix
+  {
+    Matrix(size_t lenReadout, size_t numViews)
+      : values(lenReadout * numViews), stride0(1), stride1(lenReadout)
+    {
+    }
+
+    const std::complex<T>& operator()(int i, int j) const
+    {
+      return values[i * stride0 + j * stride1];
+    }
+
+    std::vector<std::complex<T> > values;
+    ptrdiff_t stride0;
+    ptrdiff_t stride1;
+  };
+
+
+  /** Stand-in for an ISMRMRD image indexed by (x, y, z, channel) */
+  struct Volume
+  {
+    Volume(size_t x, size_t y, size_t z, size_t c)
+      : values(x * y * z * c)
+    {
+      size[0] = x; size[1] = y; size[2] = z; size[3] = c;
+    }
+
+    std::complex<float>& operator()(size_t x, size_t y, size_t z, size_t c)
+    {
+      return values[x + size[0] * (y + size[1] * (z + size[2] * c))];
+    }
+
+    std::vector<std::complex<float> > values;
+    size_t size[4];
+  };
+
+
+  template <typename T>
+    Matrix<T> synthetic(size_t lenReadout, size_t numViews)
+  {
+    Matrix<T> matrix(lenReadout, numViews);
+    for (size_t i = 0; i < matrix.values.size(); i++)
+      // every fourth view left empty, as with partial Fourier or ZIP
+      if ((i / lenReadout) % 4 != 3)
+        matrix.values[i] = std::complex<T>((T) (std::rand() % 2001 - 1000), (T) (std::rand() % 2001 - 1000));
+    return matrix;
+  }
+
+
+  /** Reads a matrix as float, converting integer samples */
+  template <typename T>
+    const Matrix<float>& readAsFloat(const Matrix<T>& matrix, Matrix<float>& converted)
+  {
+    for (size_t i = 0; i < matrix.values.size(); i++)
+      converted.values[i] = std::complex<float>(matrix.values[i].real(), matrix.values[i].imag());
+    return converted;
+  }
+
+
+  const Matrix<float>& readAsFloat(const Matrix<float>& matrix, Matrix<float>& /* converted */)
+  {
+    return matrix;
+  }
+
+
+  double seconds(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+
+  /** Prevents the copies from being optimized away */
+  volatile float g_sink;
+
+
+  template <typename T>
+    void benchType(const char* name, size_t lenReadout, size_t numViews, size_t numBlocks, size_t repeats)
+  {
+    Matrix<T> matrix = synthetic<T>(lenReadout, numViews);
+    Matrix<float> converted(lenReadout, numViews);
+    Volume volume(lenReadout, numViews, numBlocks, 1);
+    std::vector<char> acquired(numViews);
+    double samples = (double) lenReadout * numViews * numBlocks * repeats;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i_repeat = 0; i_repeat < repeats; i_repeat++) {
+      for (size_t i_block = 0; i_block < numBlocks; i_block++) {
+        const Matrix<float>& kspaceFromFile = readAsFloat(matrix, converted);
+        for (unsigned int i_view = 0; i_view < numViews; i_view++) {
+          bool nonzero = false;
+          for (unsigned int i = 0; i < lenReadout; i++) {
+            std::complex<float>& sample = volume(i, i_view, i_block, 0);
+            sample = kspaceFromFile((int)i, (int)i_view);
+            nonzero |= (sample.real() != 0) | (sample.imag() != 0);
+          }
+          acquired[i_view] |= nonzero;
+        }
+      }
+    }
+    double generic = seconds(start);
+    g_sink = volume.values[lenReadout].real() + acquired[1];
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i_repeat = 0; i_repeat < repeats; i_repeat++) {
+      for (size_t i_block = 0; i_block < numBlocks; i_block++) {
+        std::complex<float>* block = &volume(0, 0, i_block, 0);
+        GeToIsmrmrd::widenMatrix(&matrix.values[0], matrix.stride0, matrix.stride1, lenReadout, numViews, block);
+        for (size_t i_view = 0; i_view < numViews; i_view++)
+          acquired[i_view] |= GeToIsmrmrd::anyNonzero(block + i_view * lenReadout, lenReadout);
+      }
+    }
+    double specialized = seconds(start);
+    g_sink = volume.values[lenReadout].real() + acquired[1];
+
+    std::printf("%8s %14.3f %14.3f %8.2f\n", name, 1e9 * generic / samples, 1e9 * specialized / samples,
+                generic / specialized);
+  }
+
+} // namespace
+
+
+int main(int argc, char** argv)
+{
+  size_t lenReadout = argc > 1 ? std::atoi(argv[1]) : 256;
+  size_t numViews = argc > 2 ? std::atoi(argv[2]) : 256;
+  size_t numBlocks = argc > 3 ? std::atoi(argv[3]) : 32;
+  size_t repeats = argc > 4 ? std::atoi(argv[4]) : 20;
+
+  std::printf("%zu x %zu samples, %zu slices x channels, %zu repeats\n",
+              lenReadout, numViews, numBlocks, repeats);
+  std::printf("%8s %14s %14s %8s\n", "type", "generic ns", "kernel ns", "speedup");
+  benchType<int16_t>("int16", lenReadout, numViews, numBlocks, repeats);
+  benchType<int32_t>("int32", lenReadout, numViews, numBlocks, repeats);
+  benchType<float>("float", lenReadout, numViews, numBlocks, repeats);
+  return 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/bash
+#
+# Times a conversion with 1..N threads to show how the converter scales.
+#
+# usage: bench/thread_scaling.sh <input file> [max threads] [extra converter options]
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 <input file> [max threads] [extra converter options]"
+  exit 1
+fi
+
+input=$1
+max_threads=${2:-$(nproc)}
+shift
+[ $# -gt 0 ] && shift
+converter=${CONVERTER:-ge_to_ismrmrd}
+output=$(mktemp --suffix=.h5)
+trap "rm -f $output" EXIT
+
+printf "%8s %10s %8s\n" threads seconds speedup
+for ((threads = 1; threads <= max_threads; threads++)); do
+  rm -f $output
+  start=$(date +%s.%N)
+  $converter --threads $threads "$@" -o $output "$input" > /dev/null || exit 1
+  end=$(date +%s.%N)
+  seconds=$(echo "$end - $start" | bc -l)
+  if [ $threads -eq 1 ]; then
+    baseline=$seconds
+  fi
+  printf "%8d %10.2f %8.2f\n" $threads $seconds $(echo "$baseline / $seconds" | bc -l)
+done
@@ -0,0 +1,168 @@
+
+/** @file AcquisitionIndex.cpp */
+#include <algorithm>
+#include <stdexcept>
+
+// Local
+#include "AcquisitionIndex.h"
+
+namespace GeToIsmrmrd {
+
+  namespace {
+
+    bool matches(int selected, uint32_t value)
+    {
+      return selected == AcquisitionSelection::ANY || (uint32_t) selected == value;
+    }
+
+  } // namespace
+
+
+  AcquisitionSelection::AcquisitionSelection()
+    : slice(ANY),
+      contrast(ANY),
+      phase(ANY),
+      kspace_encode_step_1(ANY),
+      kspace_encode_step_2(ANY),
+      segment(ANY)
+  {
+  }
+
+
+  AcquisitionIndex::AcquisitionIndex()
+    : m_numRows(0)
+  {
+  }
+
+
+  /**
+   * Reads the index stored in an ISMRMRD file. Every conversion appended to
+   * a file stores an index of all its rows, so the last one is read. Files
+   * written without an index, or with acquisitions appended after the last
+   * one, are indexed by reading every acquisition once.
+   */
+  AcquisitionIndex AcquisitionIndex::load(ISMRMRD::Dataset& d)
+  {
+    AcquisitionIndex index;
+    uint32_t numAcquisitions = d.getNumberOfAcquisitions();
+
+    uint32_t numArrays = d.getNumberOfNDArrays(ACQUISITION_INDEX_NAME);
+    if (numArrays > 0) {
+      ISMRMRD::NDArray<uint32_t> array;
+      d.readNDArray(ACQUISITION_INDEX_NAME, numArrays - 1, array);
+      if (array.getNumberOfElements() % FIELDS != 0)
+        throw std::runtime_error("Malformed acquisition index");
+
+      index.m_runs.assign(array.getDataPtr(), array.getDataPtr() + array.getNumberOfElements());
+      for (size_t i = 0; i < index.m_runs.size(); i += FIELDS)
+        index.m_numRows = std::max<size_t>(index.m_numRows, index.m_runs[i + FIRST_ROW] + index.m_runs[i + NUM_ROWS]);
+      if (index.m_numRows == numAcquisitions)
+        return index;
+      index = AcquisitionIndex();
+    }
+
+    ISMRMRD::Acquisition acq;
+    for (uint32_t i_row = 0; i_row < numAcquisitions; i_row++) {
+      d.readAcquisition(i_row, acq);
+      index.add(acq.getHead());
+    }
+    return index;
+  }
+
+
+  /**
+   * Records the next row written
+   */
+  void AcquisitionIndex::add(const ISMRMRD::AcquisitionHeader& head)
+  {
+    const ISMRMRD::EncodingCounters& idx = head.idx;
+
+    if (!m_runs.empty()) {
+      uint32_t* last = &m_runs[m_runs.size() - FIELDS];
+      if (last[SLICE] == idx.slice && last[CONTRAST] == idx.contrast && last[PHASE] == idx.phase
+          && last[STEP_2] == idx.kspace_encode_step_2 && last[SEGMENT] == idx.segment
+          && last[FIRST_STEP_1] + last[NUM_ROWS] == idx.kspace_encode_step_1) {
+        last[NUM_ROWS]++;
+        m_numRows++;
+        return;
+      }
+    }
+
+    uint32_t run[FIELDS];
+    run[SLICE] = idx.slice;
+    run[CONTRAST] = idx.contrast;
+    run[PHASE] = idx.phase;
+    run[STEP_2] = idx.kspace_encode_step_2;
+    run[SEGMENT] = idx.segment;
+    run[FIRST_STEP_1] = idx.kspace_encode_step_1;
+    run[FIRST_ROW] = (uint32_t) m_numRows;
+    run[NUM_ROWS] = 1;
+    m_runs.insert(m_runs.end(), run, run + FIELDS);
+    m_numRows++;
+  }
+
+
+  size_t AcquisitionIndex::numRows() const
+  {
+    return m_numRows;
+  }
+
+
+  size_t AcquisitionIndex::numRuns() const
+  {
+    return m_runs.size() / FIELDS;
+  }
+
+
+  ISMRMRD::NDArray<uint32_t> AcquisitionIndex::toArray() const
+  {
+    std::vector<size_t> dims = {FIELDS, numRuns()};
+    ISMRMRD::NDArray<uint32_t> array(dims);
+    std::copy(m_runs.begin(), m_runs.end(), array.getDataPtr());
+    return array;
+  }
+
+
+  /**
+   * Rows of the selected acquisitions, in file order
+   */
+  std::vector<uint32_t> AcquisitionIndex::rows(const AcquisitionSelection& selection) const
+  {
+    std::vector<uint32_t> rows;
+    for (size_t i = 0; i < m_runs.size(); i += FIELDS) {
+      const uint32_t* run = &m_runs[i];
+      if (!matches(selection.slice, run[SLICE]) || !matches(selection.contrast, run[CONTRAST])
+          || !matches(selection.phase, run[PHASE]) || !matches(selection.kspace_encode_step_2, run[STEP_2])
+          || !matches(selection.segment, run[SEGMENT]))
+        continue;
+
+      if (selection.kspace_encode_step_1 == AcquisitionSelection::ANY) {
+        for (uint32_t i_row = 0; i_row < run[NUM_ROWS]; i_row++)
+          rows.push_back(run[FIRST_ROW] + i_row);
+      }
+      else if ((uint32_t) selection.kspace_encode_step_1 >= run[FIRST_STEP_1]
+               && (uint32_t) selection.kspace_encode_step_1 < run[FIRST_STEP_1] + run[NUM_ROWS]) {
+        rows.push_back(run[FIRST_ROW] + selection.kspace_encode_step_1 - run[FIRST_STEP_1]);
+      }
+    }
+
+    return rows;
+  }
+
+
+  /**
+   * Reads only the selected acquisitions
+   *
+   * @returns number of acquisitions read
+   */
+  size_t AcquisitionIndex::read(ISMRMRD::Dataset& d, const AcquisitionSelection& selection,
+                                std::vector<ISMRMRD::Acquisition>& acquisitions) const
+  {
+    std::vector<uint32_t> selected = rows(selection);
+    acquisitions.resize(selected.size());
+    for (size_t i = 0; i < selected.size(); i++)
+      d.readAcquisition(selected[i], acquisitions[i]);
+    return selected.size();
+  }
+
+} // namespace GeToIsmrmrd
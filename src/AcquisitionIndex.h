@@ -0,0 +1,76 @@
+/** @file AcquisitionIndex.h */
+#ifndef ACQUISITION_INDEX_H
+#define ACQUISITION_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+namespace GeToIsmrmrd {
+
+  /** NDArray holding the index in an ISMRMRD file */
+  static const char* const ACQUISITION_INDEX_NAME = "acquisition_index";
+
+
+  /**
+   * Encoding counters to select acquisitions by; ANY matches every value
+   */
+  struct AcquisitionSelection
+  {
+    static const int ANY = -1;
+
+    AcquisitionSelection();
+
+    int slice;
+    int contrast;
+    int phase;
+    int kspace_encode_step_1;
+    int kspace_encode_step_2;
+    int segment;
+  };
+
+
+  /**
+   * Maps encoding counters to rows of the acquisition data of an ISMRMRD
+   * file.
+   *
+   * Consecutive rows with the same slice, contrast, phase,
+   * kspace_encode_step_2 and segment whose kspace_encode_step_1 counts up
+   * by one form a run; the index is the list of runs. DatasetSink builds
+   * it while writing and stores it as a uint32 array "acquisition_index"
+   * of dimensions (FIELDS, runs) holding slice, contrast, phase,
+   * kspace_encode_step_2, segment, first kspace_encode_step_1, first row
+   * and row count of each run. A conversion appended to an existing file
+   * continues the file's index and stores it again as a further array.
+   */
+  class AcquisitionIndex
+  {
+  public:
+    enum Field { SLICE, CONTRAST, PHASE, STEP_2, SEGMENT, FIRST_STEP_1, FIRST_ROW, NUM_ROWS, FIELDS };
+
+    AcquisitionIndex();
+
+    static AcquisitionIndex load(ISMRMRD::Dataset& d);
+
+    void add(const ISMRMRD::AcquisitionHeader& head);
+    size_t numRows() const;
+    size_t numRuns() const;
+    ISMRMRD::NDArray<uint32_t> toArray() const;
+
+    std::vector<uint32_t> rows(const AcquisitionSelection& selection) const;
+    size_t read(ISMRMRD::Dataset& d, const AcquisitionSelection& selection,
+                std::vector<ISMRMRD::Acquisition>& acquisitions) const;
+
+  private:
+    std::vector<uint32_t> m_runs;
+    size_t m_numRows;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // ACQUISITION_INDEX_H
@@ -0,0 +1,333 @@
+
+/** @file Catalog.cpp */
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// ISMRMRD
+#include "ismrmrd/xml.h"
+
+// Local
+#include "Catalog.h"
+#include "DatasetSink.h"
+
+namespace GeToIsmrmrd {
+
+  namespace {
+
+    const char* const FIELD_NAMES[] = {
+      "format", "protocol", "series_description", "psd_name", "coil",
+      "field_strength_T", "receiver_channels", "TR", "TE",
+      "matrix_x", "matrix_y", "matrix_z", "series_date", "series_time"
+    };
+    const size_t NUM_FIELDS = sizeof(FIELD_NAMES) / sizeof(FIELD_NAMES[0]);
+
+    template <typename T>
+      std::string toString(const T& value)
+    {
+      std::ostringstream str;
+      str << value;
+      std::string result = str.str();
+      // keep the catalog one row per file and one column per field
+      for (size_t i = 0; i < result.size(); i++)
+        if (result[i] == '\t' || result[i] == '\n' || result[i] == '\r')
+          result[i] = ' ';
+      return result;
+    }
+
+    template <typename T>
+      std::string toString(const ISMRMRD::Optional<T>& value)
+    {
+      return value.is_present() ? toString(value.get()) : "";
+    }
+
+    std::string firstValue(const ISMRMRD::Optional<std::vector<float> >& values)
+    {
+      return (values.is_present() && !values.get().empty()) ? toString(values.get()[0]) : "";
+    }
+
+    std::vector<std::string> split(const std::string& line)
+    {
+      std::vector<std::string> columns;
+      std::istringstream str(line);
+      std::string column;
+      while (std::getline(str, column, '\t'))
+        columns.push_back(column);
+      if (!line.empty() && line[line.size() - 1] == '\t')
+        columns.push_back("");
+      return columns;
+    }
+
+  } // namespace
+
+
+  /**
+   * @param catalogPath catalog file; an existing catalog is updated incrementally
+   * @param threadPool pool used to read headers in parallel
+   */
+  Catalog::Catalog(const std::string& catalogPath, std::shared_ptr<ThreadPool> threadPool, bool logging)
+    : m_catalogPath(catalogPath),
+      m_anonString(""),
+      m_threadPool(threadPool),
+      m_log(logging)
+  {
+  }
+
+
+  /**
+   * Specify string to anonymize the catalogued headers
+   */
+  void Catalog::setAnonString(const std::string anonString)
+  {
+    m_anonString.assign(anonString);
+  }
+
+
+  /**
+   * Brings the catalog up to date with the raw files under the directories
+   * and writes it out
+   *
+   * @returns number of files whose header was read
+   */
+  size_t Catalog::update(const std::vector<std::string>& directories)
+  {
+    load();
+
+    std::map<std::string, Entry> files;
+    for (size_t i = 0; i < directories.size(); i++)
+      scan(directories[i], files);
+
+    std::vector<std::string> changed;
+    for (std::map<std::string, Entry>::iterator it = files.begin(); it != files.end(); ++it) {
+      std::map<std::string, Entry>::const_iterator known = m_entries.find(it->first);
+      if (known != m_entries.end() && known->second.size == it->second.size
+          && known->second.mtime == it->second.mtime)
+        it->second.fields = known->second.fields;
+      else
+        changed.push_back(it->first);
+    }
+    m_log << "Found " << files.size() << " raw files, " << changed.size() << " new or changed" << std::endl;
+
+    std::vector<std::vector<std::string> > fields(changed.size());
+    std::vector<std::string> errors(changed.size());
+    std::vector<char> openFailed(changed.size(), 0);
+    m_threadPool->parallelFor(changed.size(), [&](size_t i_file) {
+      try {
+        fields[i_file] = extract(changed[i_file]);
+      } catch (const std::system_error& e) {
+        // e.g. permissions or too many open files: not a property of the file
+        openFailed[i_file] = 1;
+        errors[i_file] = e.what();
+      } catch (const std::exception& e) {
+        // recorded as unreadable, so it is retried only once the file changes
+        fields[i_file] = std::vector<std::string>(NUM_FIELDS, "");
+        fields[i_file][0] = "unreadable";
+        errors[i_file] = e.what();
+      }
+    });
+
+    size_t numRead = 0;
+    for (size_t i_file = 0; i_file < changed.size(); i_file++) {
+      if (openFailed[i_file]) {
+        // left out of the catalog, so the next update tries again
+        m_log << "Failed to open " << changed[i_file] << ": " << errors[i_file] << std::endl;
+        files.erase(changed[i_file]);
+        continue;
+      }
+      if (!errors[i_file].empty())
+        m_log << "Failed to read " << changed[i_file] << ": " << errors[i_file] << std::endl;
+      files[changed[i_file]].fields = fields[i_file];
+      numRead++;
+    }
+
+    m_entries.swap(files);
+    save();
+
+    return numRead;
+  }
+
+
+  /**
+   * P-files are named P*.7; ScanArchives are recognised by Orchestra
+   */
+  bool Catalog::isRawFile(const std::string& filepath)
+  {
+    size_t slash = filepath.find_last_of('/');
+    std::string name = (slash == std::string::npos) ? filepath : filepath.substr(slash + 1);
+    bool isPfile = name.size() > 3 && name[0] == 'P'
+      && name.compare(name.size() - 2, 2, ".7") == 0;
+    return isPfile || GERecon::ScanArchive::IsArchiveFilePath(filepath);
+  }
+
+
+  void Catalog::load()
+  {
+    m_entries.clear();
+
+    std::ifstream in(m_catalogPath.c_str());
+    std::string line;
+    std::getline(in, line); // column names
+    while (std::getline(in, line)) {
+      std::vector<std::string> columns = split(line);
+      // rows written with a different set of fields are read again
+      if (columns.size() != 3 + NUM_FIELDS)
+        continue;
+
+      Entry entry;
+      entry.size = std::strtoll(columns[1].c_str(), NULL, 10);
+      entry.mtime = std::strtoll(columns[2].c_str(), NULL, 10);
+      entry.fields.assign(columns.begin() + 3, columns.end());
+      m_entries[columns[0]] = entry;
+    }
+  }
+
+
+  /**
+   * Writes the catalog to a temporary file and renames it into place, so
+   * readers never see a half-written catalog
+   */
+  void Catalog::save() const
+  {
+    std::string tmpPath = m_catalogPath + ".tmp";
+    std::ofstream out(tmpPath.c_str());
+    if (!out)
+      throw std::runtime_error("Failed to open " + tmpPath);
+
+    out << "path\tsize\tmtime";
+    for (size_t i = 0; i < NUM_FIELDS; i++)
+      out << "\t" << FIELD_NAMES[i];
+    out << "\n";
+
+    for (std::map<std::string, Entry>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+      out << it->first << "\t" << it->second.size << "\t" << it->second.mtime;
+      for (size_t i = 0; i < it->second.fields.size(); i++)
+        out << "\t" << it->second.fields[i];
+      out << "\n";
+    }
+
+    out.close();
+    if (!out || std::rename(tmpPath.c_str(), m_catalogPath.c_str()) != 0)
+      throw std::runtime_error("Failed to write " + m_catalogPath);
+  }
+
+
+  /**
+   * Recursively collects raw files with their size and modification time.
+   * Symbolic links to directories are not followed.
+   */
+  void Catalog::scan(const std::string& directory, std::map<std::string, Entry>& files)
+  {
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) {
+      m_log << "Cannot read directory " << directory << std::endl;
+      return;
+    }
+
+    while (struct dirent* entry = readdir(dir)) {
+      std::string name(entry->d_name);
+      if (name == "." || name == "..")
+        continue;
+
+      std::string path = directory + "/" + name;
+      struct stat info;
+      if (lstat(path.c_str(), &info) != 0)
+        continue;
+      if (S_ISDIR(info.st_mode)) {
+        scan(path, files);
+        continue;
+      }
+      if (S_ISLNK(info.st_mode) && stat(path.c_str(), &info) != 0)
+        continue;
+      if (!S_ISREG(info.st_mode) || !isRawFile(path))
+        continue;
+
+      Entry& file = files[path];
+      file.size = info.st_size;
+      file.mtime = info.st_mtime;
+    }
+
+    closedir(dir);
+  }
+
+
+  std::vector<std::string> Catalog::extract(const std::string& filepath) const
+  {
+    bool isArchive = GERecon::ScanArchive::IsArchiveFilePath(filepath);
+
+    // ScanArchives are read through HDF5, one at a time unless it is
+    // thread-safe; the lock outlives the converter
+    std::unique_lock<std::mutex> archiveLock(m_archiveMutex, std::defer_lock);
+    if (isArchive && !hdf5ThreadSafe())
+      archiveLock.lock();
+
+    GERawConverter converter(filepath);
+    converter.setAnonString(m_anonString);
+    ISMRMRD::IsmrmrdHeader header = converter.getIsmrmrdHeader();
+
+    std::vector<std::string> fields;
+    fields.push_back(isArchive ? "ScanArchive" : "PFile");
+
+    if (header.measurementInformation.is_present()) {
+      fields.push_back(toString(header.measurementInformation.get().protocolName));
+      fields.push_back(toString(header.measurementInformation.get().seriesDescription));
+    }
+    else {
+      fields.push_back("");
+      fields.push_back("");
+    }
+
+    std::string psdName;
+    if (header.userParameters.is_present()) {
+      const std::vector<ISMRMRD::UserParameterString>& strings = header.userParameters.get().userParameterString;
+      for (size_t i = 0; i < strings.size(); i++)
+        if (strings[i].name == "PSDName")
+          psdName = toString(strings[i].value);
+    }
+    fields.push_back(psdName);
+
+    if (header.acquisitionSystemInformation.is_present()) {
+      const ISMRMRD::AcquisitionSystemInformation& system = header.acquisitionSystemInformation.get();
+      fields.push_back(system.coilLabel.empty() ? "" : toString(system.coilLabel[0].coilName));
+      fields.push_back(toString(system.systemFieldStrength_T));
+      fields.push_back(toString(system.receiverChannels));
+    }
+    else {
+      fields.push_back("");
+      fields.push_back("");
+      fields.push_back("");
+    }
+
+    if (header.sequenceParameters.is_present()) {
+      fields.push_back(firstValue(header.sequenceParameters.get().TR));
+      fields.push_back(firstValue(header.sequenceParameters.get().TE));
+    }
+    else {
+      fields.push_back("");
+      fields.push_back("");
+    }
+
+    const ISMRMRD::MatrixSize& matrix = header.encoding.at(0).encodedSpace.matrixSize;
+    fields.push_back(toString(matrix.x));
+    fields.push_back(toString(matrix.y));
+    fields.push_back(toString(matrix.z));
+
+    if (header.measurementInformation.is_present()) {
+      fields.push_back(toString(header.measurementInformation.get().seriesDate));
+      fields.push_back(toString(header.measurementInformation.get().seriesTime));
+    }
+    else {
+      fields.push_back("");
+      fields.push_back("");
+    }
+
+    return fields;
+  }
+
+} // namespace GeToIsmrmrd
@@ -0,0 +1,62 @@
+/** @file Catalog.h */
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Local
+#include "GERawConverter.h"
+#include "ThreadPool.h"
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Tab-separated catalog of the headers of the raw files (P-files and
+   * ScanArchives) found under a set of directories.
+   *
+   * Each row holds the file path, size and modification time followed by
+   * the searchable header fields. On update only files that are new or
+   * whose size or modification time changed are read again; rows of files
+   * that disappeared are dropped.
+   */
+  class Catalog
+  {
+  public:
+    Catalog(const std::string& catalogPath, std::shared_ptr<ThreadPool> threadPool,
+            bool logging=false);
+
+    void setAnonString(const std::string anonString);
+    size_t update(const std::vector<std::string>& directories);
+
+    static bool isRawFile(const std::string& filepath);
+
+  private:
+    Catalog(const Catalog& other);
+    Catalog& operator=(const Catalog& other);
+
+    struct Entry {
+      long long size;
+      long long mtime;
+      std::vector<std::string> fields;
+    };
+
+    void load();
+    void save() const;
+    void scan(const std::string& directory, std::map<std::string, Entry>& files);
+    std::vector<std::string> extract(const std::string& filepath) const;
+
+    std::string m_catalogPath;
+    std::string m_anonString;
+    std::shared_ptr<ThreadPool> m_threadPool;
+    mutable std::mutex m_archiveMutex;
+    std::map<std::string, Entry> m_entries;
+    logstream m_log;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // CATALOG_H
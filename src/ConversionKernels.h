@@ -0,0 +1,128 @@
+/** @file ConversionKernels.h */
+#ifndef CONVERSION_KERNELS_H
+#define CONVERSION_KERNELS_H
+
+#include <algorithm>
+#include <complex>
+#include <cstddef>
+
+namespace GeToIsmrmrd {
+
+  /*
+   * Copy loops of the conversion, compiled for each stored sample type.
+   *
+   * Sources are complex samples addressed by a pointer and strides in
+   * samples, as Orchestra's MDArray hands them out; destinations are
+   * contiguous. A contiguous source is copied as one flat loop over real
+   * and imaginary parts, which the compiler vectorizes.
+   */
+
+  /**
+   * Copies a readout of complex T samples, sampleStride samples apart, to
+   * complex float
+   */
+  template <typename T>
+    inline void widenReadout(const std::complex<T>* src, ptrdiff_t sampleStride, size_t length,
+                             std::complex<float>* dst)
+  {
+    if (sampleStride == 1) {
+      const T* in = reinterpret_cast<const T*>(src);
+      float* out = reinterpret_cast<float*>(dst);
+      for (size_t i = 0; i < 2 * length; i++)
+        out[i] = static_cast<float>(in[i]);
+    }
+    else {
+      for (size_t i = 0; i < length; i++)
+        dst[i] = std::complex<float>(src[i * sampleStride].real(), src[i * sampleStride].imag());
+    }
+  }
+
+
+  /**
+   * Copies a readout of complex float samples, sampleStride samples apart;
+   * a contiguous readout is a plain copy
+   */
+  inline void widenReadout(const std::complex<float>* src, ptrdiff_t sampleStride, size_t length,
+                           std::complex<float>* dst)
+  {
+    if (sampleStride == 1) {
+      std::copy(src, src + length, dst);
+    }
+    else {
+      for (size_t i = 0; i < length; i++)
+        dst[i] = src[i * sampleStride];
+    }
+  }
+
+
+  /**
+   * Copies a readout of complex T samples, sampleStride samples apart, to
+   * T with real and imaginary parts interleaved
+   */
+  template <typename T>
+    inline void interleaveReadout(const std::complex<T>* src, ptrdiff_t sampleStride, size_t length, T* dst)
+  {
+    if (sampleStride == 1) {
+      const T* in = reinterpret_cast<const T*>(src);
+      for (size_t i = 0; i < 2 * length; i++)
+        dst[i] = in[i];
+    }
+    else {
+      for (size_t i = 0; i < length; i++) {
+        dst[2 * i] = src[i * sampleStride].real();
+        dst[2 * i + 1] = src[i * sampleStride].imag();
+      }
+    }
+  }
+
+
+  /**
+   * Copies numViews readouts of a (readout, view) matrix to contiguous
+   * complex float, one readout after the other
+   */
+  template <typename T>
+    inline void widenMatrix(const std::complex<T>* src, ptrdiff_t sampleStride, ptrdiff_t viewStride,
+                            size_t lenReadout, size_t numViews, std::complex<float>* dst)
+  {
+    if (sampleStride == 1 && viewStride == (ptrdiff_t) lenReadout) {
+      widenReadout(src, 1, lenReadout * numViews, dst);
+      return;
+    }
+    for (size_t i_view = 0; i_view < numViews; i_view++)
+      widenReadout(src + i_view * viewStride, sampleStride, lenReadout, dst + i_view * lenReadout);
+  }
+
+
+  /**
+   * Copies numViews readouts of a (readout, view) matrix to contiguous T,
+   * real and imaginary parts interleaved
+   */
+  template <typename T>
+    inline void interleaveMatrix(const std::complex<T>* src, ptrdiff_t sampleStride, ptrdiff_t viewStride,
+                                 size_t lenReadout, size_t numViews, T* dst)
+  {
+    if (sampleStride == 1 && viewStride == (ptrdiff_t) lenReadout) {
+      interleaveReadout(src, 1, lenReadout * numViews, dst);
+      return;
+    }
+    for (size_t i_view = 0; i_view < numViews; i_view++)
+      interleaveReadout(src + i_view * viewStride, sampleStride, lenReadout, dst + 2 * i_view * lenReadout);
+  }
+
+
+  /**
+   * Whether a contiguous readout holds any nonzero sample
+   */
+  inline bool anyNonzero(const std::complex<float>* readout, size_t length)
+  {
+    // acquired readouts stop at their first samples, which hold noise
+    const float* values = reinterpret_cast<const float*>(readout);
+    for (size_t i = 0; i < 2 * length; i++)
+      if (values[i] != 0.0f)
+        return true;
+    return false;
+  }
+
+} // namespace GeToIsmrmrd
+
+#endif  // CONVERSION_KERNELS_H
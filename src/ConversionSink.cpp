@@ -0,0 +1,27 @@
+
+/** @file ConversionSink.cpp */
+#include <stdexcept>
+
+// Local
+#include "ConversionSink.h"
+
+namespace GeToIsmrmrd {
+
+  void ConversionSink::onImage(const std::string& name, const ISMRMRD::Image<short>&)
+  {
+    throw std::runtime_error("Output does not accept native int16 k-space (" + name + ")");
+  }
+
+
+  void ConversionSink::onImage(const std::string& name, const ISMRMRD::Image<int>&)
+  {
+    throw std::runtime_error("Output does not accept native int32 k-space (" + name + ")");
+  }
+
+
+  void ConversionSink::onArray(const std::string& name, const ISMRMRD::NDArray<std::complex<float> >&)
+  {
+    throw std::runtime_error("Output does not accept hybrid-space arrays (" + name + ")");
+  }
+
+} // namespace GeToIsmrmrd
@@ -0,0 +1,46 @@
+/** @file ConversionSink.h */
+#ifndef CONVERSION_SINK_H
+#define CONVERSION_SINK_H
+
+#include <complex>
+#include <string>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Receives the data produced by GERawConverter.
+   *
+   * Everything is handed over by reference and is only valid for the
+   * duration of the call; a sink that keeps data must copy it.
+   * Applications embedding the converter implement this interface to get
+   * the data in-process instead of reading it back from an HDF5 file.
+   *
+   * Only header, noise, acquisitions and complex k-space are required.
+   * Native integer k-space (--native) and hybrid-space arrays (--hybrid)
+   * are optional; a sink that does not override them fails the conversion
+   * when such data arrives. The interface needs no HDF5; DatasetSink (in
+   * DatasetSink.h) writes ISMRMRD files.
+   */
+  class ConversionSink
+  {
+  public:
+    virtual ~ConversionSink() {}
+
+    virtual void onHeader(const std::string& xmlHeader) = 0;
+    virtual void onNoise(const std::string& name, const ISMRMRD::NDArray<float>& values) = 0;
+    virtual void onAcquisition(const ISMRMRD::Acquisition& acq) = 0;
+    virtual void onImage(const std::string& name, const ISMRMRD::Image<std::complex<float> >& image) = 0;
+    virtual void onImage(const std::string& name, const ISMRMRD::Image<short>& image);
+    virtual void onImage(const std::string& name, const ISMRMRD::Image<int>& image);
+    virtual void onArray(const std::string& name, const ISMRMRD::NDArray<std::complex<float> >& array);
+
+    /** Called once after the last piece of data of a file */
+    virtual void onComplete() {}
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // CONVERSION_SINK_H
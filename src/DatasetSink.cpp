@@ -0,0 +1,82 @@
+
+/** @file DatasetSink.cpp */
+
+// HDF5
+#include <H5pubconf.h>
+
+// Local
+#include "DatasetSink.h"
+
+namespace GeToIsmrmrd {
+
+  bool hdf5ThreadSafe()
+  {
+#ifdef H5_HAVE_THREADSAFE
+    return true;
+#else
+    return false;
+#endif
+  }
+
+
+  /**
+   * Acquisitions already in the dataset, e.g. when a file is converted into
+   * again, stay covered by the index, which then counts on from them
+   */
+  DatasetSink::DatasetSink(ISMRMRD::Dataset& d)
+    : m_dataset(d),
+      m_index(AcquisitionIndex::load(d))
+  {
+  }
+
+
+  void DatasetSink::onHeader(const std::string& xmlHeader)
+  {
+    m_dataset.writeHeader(xmlHeader);
+  }
+
+
+  void DatasetSink::onNoise(const std::string& name, const ISMRMRD::NDArray<float>& values)
+  {
+    m_dataset.appendNDArray(name, values);
+  }
+
+
+  void DatasetSink::onAcquisition(const ISMRMRD::Acquisition& acq)
+  {
+    m_dataset.appendAcquisition(acq);
+    m_index.add(acq.getHead());
+  }
+
+
+  void DatasetSink::onImage(const std::string& name, const ISMRMRD::Image<std::complex<float> >& image)
+  {
+    m_dataset.appendImage(name, image);
+  }
+
+
+  void DatasetSink::onImage(const std::string& name, const ISMRMRD::Image<short>& image)
+  {
+    m_dataset.appendImage(name, image);
+  }
+
+
+  void DatasetSink::onImage(const std::string& name, const ISMRMRD::Image<int>& image)
+  {
+    m_dataset.appendImage(name, image);
+  }
+
+
+  void DatasetSink::onArray(const std::string& name, const ISMRMRD::NDArray<std::complex<float> >& array)
+  {
+    m_dataset.appendNDArray(name, array);
+  }
+
+
+  void DatasetSink::onComplete()
+  {
+    if (m_index.numRows() > 0)
+      m_dataset.appendNDArray(ACQUISITION_INDEX_NAME, m_index.toArray());
+  }
+
+} // namespace GeToIsmrmrd
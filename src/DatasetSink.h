@@ -0,0 +1,54 @@
+/** @file DatasetSink.h */
+#ifndef DATASET_SINK_H
+#define DATASET_SINK_H
+
+#include <complex>
+#include <string>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+// Local
+#include "AcquisitionIndex.h"
+#include "ConversionSink.h"
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Whether the HDF5 library was built thread-safe. Without that, only one
+   * thread at a time may write ISMRMRD files or read ScanArchives.
+   */
+  bool hdf5ThreadSafe();
+
+
+  /**
+   * Writes everything into an ISMRMRD HDF5 dataset. The acquisitions are
+   * indexed while they are written and the index is stored on completion
+   * (see AcquisitionIndex).
+   */
+  class DatasetSink : public ConversionSink
+  {
+  public:
+    DatasetSink(ISMRMRD::Dataset& d);
+
+    void onHeader(const std::string& xmlHeader);
+    void onNoise(const std::string& name, const ISMRMRD::NDArray<float>& values);
+    void onAcquisition(const ISMRMRD::Acquisition& acq);
+    void onImage(const std::string& name, const ISMRMRD::Image<std::complex<float> >& image);
+    void onImage(const std::string& name, const ISMRMRD::Image<short>& image);
+    void onImage(const std::string& name, const ISMRMRD::Image<int>& image);
+    void onArray(const std::string& name, const ISMRMRD::NDArray<std::complex<float> >& array);
+    void onComplete();
+
+  private:
+    DatasetSink(const DatasetSink& other);
+    DatasetSink& operator=(const DatasetSink& other);
+
+    ISMRMRD::Dataset& m_dataset;
+    AcquisitionIndex m_index;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // DATASET_SINK_H
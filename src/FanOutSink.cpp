@@ -0,0 +1,228 @@
+
+/** @file FanOutSink.cpp */
+#include <stdexcept>
+
+// Local
+#include "DatasetSink.h"
+#include "FanOutSink.h"
+
+namespace GeToIsmrmrd {
+
+  /**
+   * @param queueBytes bytes of data queued per output before the converter blocks
+   */
+  FanOutSink::FanOutSink(size_t queueBytes)
+    : m_queueBytes(queueBytes),
+      m_threaded(hdf5ThreadSafe())
+  {
+  }
+
+
+  /**
+   * Stops the outputs; calls still queued are dropped when onComplete()
+   * was not reached
+   */
+  FanOutSink::~FanOutSink()
+  {
+    for (size_t i = 0; i < m_branches.size(); i++) {
+      std::lock_guard<std::mutex> lock(m_branches[i]->mutex);
+      if (!m_branches[i]->closing)
+        m_branches[i]->calls.clear();
+    }
+    close();
+  }
+
+
+  /**
+   * Adds an output; all outputs have to be added before the first call
+   */
+  void FanOutSink::addSink(std::shared_ptr<ConversionSink> sink)
+  {
+    std::unique_ptr<Branch> branch(new Branch());
+    branch->sink = sink;
+    branch->queuedBytes = 0;
+    branch->closing = false;
+    if (m_threaded)
+      branch->thread = std::thread(&FanOutSink::branchLoop, this, std::ref(*branch));
+    m_branches.push_back(std::move(branch));
+  }
+
+
+  /**
+   * Hands data to every output: directly when the outputs are written by
+   * the calling thread, otherwise as one copy shared by their queues
+   */
+  template <typename T, typename Forward>
+    void FanOutSink::forward(const T& data, size_t numBytes, const Forward& call)
+  {
+    if (!m_threaded) {
+      for (size_t i = 0; i < m_branches.size(); i++)
+        call(*m_branches[i]->sink, data);
+      return;
+    }
+
+    std::shared_ptr<const T> copy = std::make_shared<const T>(data);
+    dispatch([copy, call](ConversionSink& sink) { call(sink, *copy); }, numBytes);
+  }
+
+
+  void FanOutSink::onHeader(const std::string& xmlHeader)
+  {
+    forward(xmlHeader, xmlHeader.size(), [](ConversionSink& sink, const std::string& header) {
+      sink.onHeader(header);
+    });
+  }
+
+
+  void FanOutSink::onNoise(const std::string& name, const ISMRMRD::NDArray<float>& values)
+  {
+    forward(values, values.getNumberOfElements() * sizeof(float),
+            [name](ConversionSink& sink, const ISMRMRD::NDArray<float>& data) { sink.onNoise(name, data); });
+  }
+
+
+  void FanOutSink::onAcquisition(const ISMRMRD::Acquisition& acq)
+  {
+    size_t numBytes = (size_t) acq.getHead().number_of_samples
+      * (acq.getHead().active_channels * sizeof(std::complex<float>)
+         + acq.getHead().trajectory_dimensions * sizeof(float));
+    forward(acq, numBytes, [](ConversionSink& sink, const ISMRMRD::Acquisition& data) {
+      sink.onAcquisition(data);
+    });
+  }
+
+
+  void FanOutSink::onImage(const std::string& name, const ISMRMRD::Image<std::complex<float> >& image)
+  {
+    forward(image, image.getNumberOfDataElements() * sizeof(std::complex<float>),
+            [name](ConversionSink& sink, const ISMRMRD::Image<std::complex<float> >& data) {
+              sink.onImage(name, data);
+            });
+  }
+
+
+  void FanOutSink::onImage(const std::string& name, const ISMRMRD::Image<short>& image)
+  {
+    forward(image, image.getNumberOfDataElements() * sizeof(short),
+            [name](ConversionSink& sink, const ISMRMRD::Image<short>& data) { sink.onImage(name, data); });
+  }
+
+
+  void FanOutSink::onImage(const std::string& name, const ISMRMRD::Image<int>& image)
+  {
+    forward(image, image.getNumberOfDataElements() * sizeof(int),
+            [name](ConversionSink& sink, const ISMRMRD::Image<int>& data) { sink.onImage(name, data); });
+  }
+
+
+  void FanOutSink::onArray(const std::string& name, const ISMRMRD::NDArray<std::complex<float> >& array)
+  {
+    forward(array, array.getNumberOfElements() * sizeof(std::complex<float>),
+            [name](ConversionSink& sink, const ISMRMRD::NDArray<std::complex<float> >& data) {
+              sink.onArray(name, data);
+            });
+  }
+
+
+  /**
+   * Completes every output and waits until all queued calls have been
+   * handled
+   *
+   * @throws the first error of any output
+   */
+  void FanOutSink::onComplete()
+  {
+    dispatch([](ConversionSink& sink) { sink.onComplete(); }, 0);
+    close();
+
+    for (size_t i = 0; i < m_branches.size(); i++)
+      if (m_branches[i]->error)
+        std::rethrow_exception(m_branches[i]->error);
+  }
+
+
+  /**
+   * Queues a call holding numBytes of data for every output, waiting while
+   * that would exceed an output's queue; an output with nothing queued
+   * always takes the call
+   */
+  void FanOutSink::dispatch(const Call& call, size_t numBytes)
+  {
+    if (!m_threaded) {
+      for (size_t i = 0; i < m_branches.size(); i++)
+        call(*m_branches[i]->sink);
+      return;
+    }
+
+    for (size_t i = 0; i < m_branches.size(); i++) {
+      Branch& branch = *m_branches[i];
+      std::unique_lock<std::mutex> lock(branch.mutex);
+      branch.changed.wait(lock, [this, &branch, numBytes]() {
+        return branch.error || branch.queuedBytes == 0 || branch.queuedBytes + numBytes <= m_queueBytes;
+      });
+      if (branch.error)
+        std::rethrow_exception(branch.error);
+      if (branch.closing)
+        throw std::runtime_error("Output already completed");
+
+      QueuedCall queued = {call, numBytes};
+      branch.calls.push_back(queued);
+      branch.queuedBytes += numBytes;
+      branch.changed.notify_all();
+    }
+  }
+
+
+  void FanOutSink::branchLoop(Branch& branch)
+  {
+    for (;;) {
+      QueuedCall queued;
+      {
+        std::unique_lock<std::mutex> lock(branch.mutex);
+        branch.changed.wait(lock, [&branch]() { return branch.closing || !branch.calls.empty(); });
+        if (branch.calls.empty())
+          return;
+        queued = branch.calls.front();
+        branch.calls.pop_front();
+      }
+
+      std::exception_ptr error;
+      try {
+        queued.call(*branch.sink);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      // the data is released before the converter is let go
+      queued.call = Call();
+
+      std::lock_guard<std::mutex> lock(branch.mutex);
+      // the call stays counted until written
+      branch.queuedBytes -= queued.numBytes;
+      if (error) {
+        // a failed output takes no more data
+        branch.error = error;
+        branch.calls.clear();
+        branch.queuedBytes = 0;
+      }
+      branch.changed.notify_all();
+    }
+  }
+
+
+  /**
+   * Lets every output finish its queue and joins the threads
+   */
+  void FanOutSink::close()
+  {
+    for (size_t i = 0; i < m_branches.size(); i++) {
+      std::lock_guard<std::mutex> lock(m_branches[i]->mutex);
+      m_branches[i]->closing = true;
+      m_branches[i]->changed.notify_all();
+    }
+
+    for (size_t i = 0; i < m_branches.size(); i++)
+      if (m_branches[i]->thread.joinable())
+        m_branches[i]->thread.join();
+  }
+
+} // namespace GeToIsmrmrd
@@ -0,0 +1,93 @@
+/** @file FanOutSink.h */
+#ifndef FAN_OUT_SINK_H
+#define FAN_OUT_SINK_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Local
+#include "ConversionSink.h"
+
+namespace GeToIsmrmrd {
+
+  /** Bytes of data queued per output before the converter waits for it */
+  static const size_t FAN_OUT_QUEUE_BYTES = 256 * 1024 * 1024;
+
+
+  /**
+   * Hands the output of one conversion to several sinks.
+   *
+   * Every call is copied once and the copy is shared by all outputs. Each
+   * output has its own thread and a queue holding at most queueBytes of
+   * data, counting the call being written; a full queue blocks the
+   * converter, so a slow output slows the conversion down instead of
+   * piling up data. A single call larger than queueBytes is queued once
+   * the output has caught up completely, so a dense k-space volume is
+   * never held more than once per output. The first error of any output fails
+   * the conversion at the next call.
+   *
+   * When HDF5 is not thread-safe, the outputs are written one after the
+   * other by the calling thread instead, without copying the data.
+   */
+  class FanOutSink : public ConversionSink
+  {
+  public:
+    FanOutSink(size_t queueBytes = FAN_OUT_QUEUE_BYTES);
+    ~FanOutSink();
+
+    void addSink(std::shared_ptr<ConversionSink> sink);
+
+    void onHeader(const std::string& xmlHeader);
+    void onNoise(const std::string& name, const ISMRMRD::NDArray<float>& values);
+    void onAcquisition(const ISMRMRD::Acquisition& acq);
+    void onImage(const std::string& name, const ISMRMRD::Image<std::complex<float> >& image);
+    void onImage(const std::string& name, const ISMRMRD::Image<short>& image);
+    void onImage(const std::string& name, const ISMRMRD::Image<int>& image);
+    void onArray(const std::string& name, const ISMRMRD::NDArray<std::complex<float> >& array);
+    void onComplete();
+
+  private:
+    FanOutSink(const FanOutSink& other);
+    FanOutSink& operator=(const FanOutSink& other);
+
+    typedef std::function<void(ConversionSink&)> Call;
+
+    /** A call with the bytes of data it holds */
+    struct QueuedCall {
+      Call call;
+      size_t numBytes;
+    };
+
+    /** One output with its queue and thread */
+    struct Branch {
+      std::shared_ptr<ConversionSink> sink;
+      std::deque<QueuedCall> calls;
+      size_t queuedBytes;
+      std::mutex mutex;
+      std::condition_variable changed;
+      std::thread thread;
+      std::exception_ptr error;
+      bool closing;
+    };
+
+    template <typename T, typename Forward>
+      void forward(const T& data, size_t numBytes, const Forward& call);
+    void dispatch(const Call& call, size_t numBytes);
+    void branchLoop(Branch& branch);
+    void close();
+
+    size_t m_queueBytes;
+    bool m_threaded;
+    std::vector<std::unique_ptr<Branch> > m_branches;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // FAN_OUT_SINK_H
@@ -0,0 +1,180 @@
+
+/** @file Fft.cpp */
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+
+// Local
+#include "Fft.h"
+
+namespace GeToIsmrmrd {
+
+  namespace {
+
+    size_t nextPowerOfTwo(size_t n)
+    {
+      size_t p = 1;
+      while (p < n)
+        p <<= 1;
+      return p;
+    }
+
+  } // namespace
+
+
+  /**
+   * Precomputes twiddle factors (and the Bluestein chirp for lengths that
+   * are not a power of two)
+   */
+  FftPlan::FftPlan(size_t length)
+    : m_length(length),
+      m_paddedLength(length)
+  {
+    if (m_length == nextPowerOfTwo(m_length)) {
+      m_twiddles = makeTwiddles(m_length);
+      return;
+    }
+
+    m_paddedLength = nextPowerOfTwo(2 * m_length - 1);
+    m_twiddles = makeTwiddles(m_paddedLength);
+
+    // chirp(k) = exp(-i pi k^2 / n); k^2 is reduced mod 2n to keep precision
+    m_chirp.resize(m_length);
+    for (size_t k = 0; k < m_length; k++) {
+      double phase = -M_PI * (double) ((k * k) % (2 * m_length)) / (double) m_length;
+      m_chirp[k] = std::complex<float>((float) std::cos(phase), (float) std::sin(phase));
+    }
+
+    m_chirpSpectrum.assign(m_paddedLength, std::complex<float>(0, 0));
+    m_chirpSpectrum[0] = std::conj(m_chirp[0]);
+    for (size_t k = 1; k < m_length; k++) {
+      m_chirpSpectrum[k] = std::conj(m_chirp[k]);
+      m_chirpSpectrum[m_paddedLength - k] = std::conj(m_chirp[k]);
+    }
+    radix2(&m_chirpSpectrum[0], m_paddedLength, m_twiddles);
+
+    m_work.resize(m_paddedLength);
+  }
+
+
+  /**
+   * Returns this thread's plan for the given length, creating it on first
+   * use, so loops running on the thread pool plan each length only once
+   * per thread
+   */
+  FftPlan& FftPlan::threadPlan(size_t length)
+  {
+    static thread_local std::map<size_t, std::shared_ptr<FftPlan> > plans;
+    std::shared_ptr<FftPlan>& plan = plans[length];
+    if (!plan)
+      plan = std::make_shared<FftPlan>(length);
+    return *plan;
+  }
+
+
+  size_t FftPlan::length() const
+  {
+    return m_length;
+  }
+
+
+  /**
+   * Unnormalized forward transform, in place
+   */
+  void FftPlan::forward(std::complex<float>* data)
+  {
+    transform(data);
+  }
+
+
+  /**
+   * Inverse transform scaled by 1/n, in place
+   */
+  void FftPlan::inverse(std::complex<float>* data)
+  {
+    for (size_t k = 0; k < m_length; k++)
+      data[k] = std::conj(data[k]);
+    transform(data);
+    float scale = 1.0f / (float) m_length;
+    for (size_t k = 0; k < m_length; k++)
+      data[k] = std::conj(data[k]) * scale;
+  }
+
+
+  /**
+   * Inverse transform of data with the k-space centre at n/2, giving an
+   * image with its centre at n/2 (ifftshift, ifft, fftshift)
+   */
+  void FftPlan::inverseCentered(std::complex<float>* data)
+  {
+    std::rotate(data, data + m_length / 2, data + m_length);
+    inverse(data);
+    std::rotate(data, data + (m_length - m_length / 2), data + m_length);
+  }
+
+
+  void FftPlan::transform(std::complex<float>* data)
+  {
+    if (m_length <= 1)
+      return;
+
+    if (m_chirp.empty()) {
+      radix2(data, m_length, m_twiddles);
+      return;
+    }
+
+    // Bluestein: X = chirp * (ifft(fft(x * chirp) * fft(conj(chirp))))
+    std::fill(m_work.begin(), m_work.end(), std::complex<float>(0, 0));
+    for (size_t k = 0; k < m_length; k++)
+      m_work[k] = data[k] * m_chirp[k];
+
+    radix2(&m_work[0], m_paddedLength, m_twiddles);
+    for (size_t k = 0; k < m_paddedLength; k++)
+      m_work[k] = std::conj(m_work[k] * m_chirpSpectrum[k]);
+    radix2(&m_work[0], m_paddedLength, m_twiddles);
+
+    float scale = 1.0f / (float) m_paddedLength;
+    for (size_t k = 0; k < m_length; k++)
+      data[k] = std::conj(m_work[k]) * scale * m_chirp[k];
+  }
+
+
+  void FftPlan::radix2(std::complex<float>* data, size_t n,
+                       const std::vector<std::complex<float> >& twiddles)
+  {
+    // bit-reversal permutation
+    for (size_t i = 1, j = 0; i < n; i++) {
+      size_t bit = n >> 1;
+      for (; j & bit; bit >>= 1)
+        j ^= bit;
+      j ^= bit;
+      if (i < j)
+        std::swap(data[i], data[j]);
+    }
+
+    for (size_t len = 2; len <= n; len <<= 1) {
+      size_t half = len / 2;
+      size_t step = n / len;
+      for (size_t start = 0; start < n; start += len) {
+        for (size_t k = 0; k < half; k++) {
+          std::complex<float> t = data[start + k + half] * twiddles[k * step];
+          data[start + k + half] = data[start + k] - t;
+          data[start + k] += t;
+        }
+      }
+    }
+  }
+
+
+  std::vector<std::complex<float> > FftPlan::makeTwiddles(size_t n)
+  {
+    std::vector<std::complex<float> > twiddles(n / 2);
+    for (size_t k = 0; k < n / 2; k++) {
+      double phase = -2.0 * M_PI * (double) k / (double) n;
+      twiddles[k] = std::complex<float>((float) std::cos(phase), (float) std::sin(phase));
+    }
+    return twiddles;
+  }
+
+} // namespace GeToIsmrmrd
@@ -0,0 +1,46 @@
+/** @file Fft.h */
+#ifndef FFT_H
+#define FFT_H
+
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Planned 1D FFT of a fixed length.
+   *
+   * Powers of two use an iterative radix-2 transform; other lengths go
+   * through Bluestein's algorithm on a padded power-of-two transform. A plan
+   * owns its work buffers, so each thread needs its own plan.
+   */
+  class FftPlan
+  {
+  public:
+    FftPlan(size_t length);
+
+    static FftPlan& threadPlan(size_t length);
+
+    size_t length() const;
+    void forward(std::complex<float>* data);
+    void inverse(std::complex<float>* data);
+    void inverseCentered(std::complex<float>* data);
+
+  private:
+    void transform(std::complex<float>* data);
+    static void radix2(std::complex<float>* data, size_t n,
+                       const std::vector<std::complex<float> >& twiddles);
+    static std::vector<std::complex<float> > makeTwiddles(size_t n);
+
+    size_t m_length;
+    size_t m_paddedLength;
+    std::vector<std::complex<float> > m_twiddles;
+    std::vector<std::complex<float> > m_chirp;
+    std::vector<std::complex<float> > m_chirpSpectrum;
+    std::vector<std::complex<float> > m_work;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // FFT_H
@@ -1,8 +1,13 @@
 
 /** @file GERawConverter.cpp */
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <system_error>
+#include <vector>
 
 // Orchestra
 #include <Orchestra/Acquisition/ControlPacket.h>
@@ -37,13 +42,79 @@
 #include <Dicom/ImagePlaneModule.h>
 
 // ISMRMRD
+#include <ismrmrd/meta.h>
 #include <ismrmrd/version.h>
 
 // Local
+#include "ConversionKernels.h"
+#include "DatasetSink.h"
+#include "Fft.h"
 #include "GERawConverter.h"
+#include "Preview.h"
 
 namespace GeToIsmrmrd {
 
+  // Number of readouts converted in parallel before they are appended in order
+  static const size_t ACQUISITION_BATCH_SIZE = 256;
+
+  /**
+   * Inverse Fourier transforms every channel of an acquisition along the
+   * readout, using the calling thread's FFT plan
+   */
+  static void readoutToImageSpace(ISMRMRD::Acquisition& acq, size_t lenReadout, size_t numChannels)
+  {
+    FftPlan& plan = FftPlan::threadPlan(lenReadout);
+    for (size_t i_channel = 0; i_channel < numChannels; i_channel++)
+      plan.inverseCentered(acq.getDataPtr() + i_channel * lenReadout);
+  }
+
+
+  /**
+   * Reads the (readout, view) matrix of one slice, echo, channel and phase
+   * in the stored sample type; ZEncoded files address slices through their
+   * pass. The Pfile is not known to be thread-safe, so reads hold
+   * pfileMutex and only the copies run in parallel.
+   */
+  template <typename T, bool ZEncoded>
+    static MDArray::Array<std::complex<T>, 2> readKSpace(GERecon::Legacy::Pfile& pfile, std::mutex& pfileMutex,
+                                                         unsigned int i_slice, unsigned int i_echo,
+                                                         unsigned int i_channel, unsigned int i_phase)
+  {
+    std::lock_guard<std::mutex> lock(pfileMutex);
+    MDArray::Array<std::complex<T>, 2> kspaceFromFile;
+    if (ZEncoded)
+      kspaceFromFile.reference(pfile.KSpaceData<T>(
+        GERecon::Legacy::Pfile::PassSlicePair(i_phase, i_slice), i_echo, i_channel));
+    else
+      kspaceFromFile.reference(pfile.KSpaceData<T>(i_slice, i_echo, i_channel, i_phase));
+    return kspaceFromFile;
+  }
+
+
+  /**
+   * Copies views [firstView, firstView + numViews) of a P-file matrix to
+   * contiguous complex float
+   */
+  template <typename T>
+    static void widenKSpace(const MDArray::Array<std::complex<T>, 2>& kspaceFromFile, size_t lenFrame,
+                            size_t firstView, size_t numViews, std::complex<float>* dst)
+  {
+    widenMatrix(kspaceFromFile.data() + firstView * kspaceFromFile.stride(1), kspaceFromFile.stride(0),
+                kspaceFromFile.stride(1), lenFrame, numViews, dst);
+  }
+
+
+  /**
+   * Sets the slice counters of an acquisition; partitions of 3D scans are
+   * kspace_encode_step_2
+   */
+  template <bool Is3D>
+    static void setSliceCounters(ISMRMRD::Acquisition& acq, uint16_t i_slice)
+  {
+    acq.idx().kspace_encode_step_2 = Is3D ? i_slice : 0;
+    acq.idx().slice = Is3D ? 0 : i_slice;
+  }
+
   std::string convert_date(const std::string& date_str) {
     if (date_str.length() == 8) {
       return date_str.substr(0, 4) + "-"
@@ -61,6 +132,54 @@ namespace GeToIsmrmrd {
   }
 
 
+  /**
+   * Anonymizes an existing header the way the converter does with an anon
+   * string: names, IDs, descriptions and UIDs are replaced by anonString,
+   * and weight, birth date, study/series dates and times, accession number,
+   * referring physician and the patient history are removed
+   */
+  void anonymizeIsmrmrdHeader(ISMRMRD::IsmrmrdHeader& header, const std::string& anonString)
+  {
+    if (header.subjectInformation.is_present()) {
+      ISMRMRD::SubjectInformation& subjectInformation = header.subjectInformation.get();
+      subjectInformation.patientName = anonString;
+      subjectInformation.patientID = anonString;
+      subjectInformation.patientWeight_kg = ISMRMRD::Optional<float>();
+      subjectInformation.patientBirthdate = ISMRMRD::Optional<std::string>();
+    }
+
+    if (header.studyInformation.is_present()) {
+      ISMRMRD::StudyInformation& studyInformation = header.studyInformation.get();
+      studyInformation.studyID = anonString;
+      studyInformation.studyDescription = anonString;
+      studyInformation.studyInstanceUID = anonString;
+      studyInformation.studyDate = ISMRMRD::Optional<std::string>();
+      studyInformation.studyTime = ISMRMRD::Optional<std::string>();
+      studyInformation.accessionNumber = ISMRMRD::Optional<long>();
+      studyInformation.referringPhysicianName = ISMRMRD::Optional<std::string>();
+    }
+
+    if (header.measurementInformation.is_present()) {
+      ISMRMRD::MeasurementInformation& measurementInformation = header.measurementInformation.get();
+      measurementInformation.protocolName = anonString;
+      measurementInformation.seriesDescription = anonString;
+      measurementInformation.seriesInstanceUIDRoot = anonString;
+      measurementInformation.seriesDate = ISMRMRD::Optional<std::string>();
+      measurementInformation.seriesTime = ISMRMRD::Optional<std::string>();
+    }
+
+    if (header.userParameters.is_present()) {
+      std::vector<ISMRMRD::UserParameterString>& strings = header.userParameters.get().userParameterString;
+      for (size_t i = 0; i < strings.size(); ) {
+        if (strings[i].name == "History")
+          strings.erase(strings.begin() + i);
+        else
+          i++;
+      }
+    }
+  }
+
+
   /**
    * Creates a GERawConverter from an ifstream of the PFile header
    *
@@ -69,17 +188,29 @@ namespace GeToIsmrmrd {
    */
   GERawConverter::GERawConverter(const std::string& filepath, bool logging)
     : m_isRDS(false),
+      m_nativeSamples(false),
+      m_hybridSpace(false),
+      m_sparse(false),
+      m_filterViews(0),
+      m_filterSlices(0),
+      m_filterPartitions(0),
+      m_qaSigma(0),
+      m_qaMaxOutliers(0),
+      m_storedSampleScale(-1),
       m_anonString(""),
       m_pfile(NULL),
       m_scanArchive(NULL),
       m_downloadDataPtr(NULL),
       m_processingControl(NULL),
+      m_threadPool(nullptr),
       m_log(logging)
   {
+    // only checks that the file can be opened; Orchestra opens it itself
     FILE* fp = NULL;
     if (!(fp = fopen(filepath.c_str(), "rb"))) {
-      throw std::runtime_error("Failed to open " + filepath);
+      throw std::system_error(errno, std::generic_category(), "Failed to open " + filepath);
     }
+    fclose(fp);
 
     m_log << "Reading data from file (" << filepath << ")..." << std::endl;
 
@@ -109,18 +240,28 @@ namespace GeToIsmrmrd {
 
 
   /**
-   * Converts the XSD ISMRMRD XML header object into a C++ string
+   * Builds the ISMRMRD XML header object from the GE header
    *
-   * @returns string represenatation of ISMRMRD XML header
    * @throws std::runtime_error
    */
-  std::string GERawConverter::getIsmrmrdXMLHeader()
+  ISMRMRD::IsmrmrdHeader GERawConverter::getIsmrmrdHeader()
   {
-
     if (m_downloadDataPtr == NULL) {
       throw std::runtime_error("DownloadData not loaded");
     }
-    ISMRMRD::IsmrmrdHeader header = lxDownloadDataToIsmrmrdHeader();
+    return lxDownloadDataToIsmrmrdHeader();
+  }
+
+
+  /**
+   * Converts the XSD ISMRMRD XML header object into a C++ string
+   *
+   * @returns string represenatation of ISMRMRD XML header
+   * @throws std::runtime_error
+   */
+  std::string GERawConverter::getIsmrmrdXMLHeader()
+  {
+    ISMRMRD::IsmrmrdHeader header = getIsmrmrdHeader();
     std::stringstream str;
     ISMRMRD::serialize(header, str);
     std::string headerXML (str.str());
@@ -146,6 +287,212 @@ namespace GeToIsmrmrd {
   }
 
 
+  /**
+   * Specify whether dense P-file k-space keeps the integer sample type it
+   * was stored with instead of being widened to complex float
+   */
+  void GERawConverter::setNativeSamples(bool nativeSamples)
+  {
+    m_nativeSamples = nativeSamples;
+  }
+
+
+  /**
+   * Specify whether the readout is inverse Fourier transformed during the
+   * conversion (x-ky-kz hybrid space). Dense P-file volumes are then
+   * written as "hybrid" arrays with x as the outermost dimension.
+   */
+  void GERawConverter::setHybridSpace(bool hybridSpace)
+  {
+    m_hybridSpace = hybridSpace;
+  }
+
+
+  /**
+   * Specify whether dense P-file k-space is stored as acquisitions of the
+   * acquired views only, skipping lines that hold no data
+   */
+  void GERawConverter::setSparse(bool sparse)
+  {
+    m_sparse = sparse;
+  }
+
+
+  /**
+   * Restrict conversion to the central numViews views of the middle
+   * numSlices slices (2D) or numPartitions partitions (3D), first echo and
+   * phase only. Used for previews; numViews = 0 converts everything.
+   */
+  void GERawConverter::setViewFilter(unsigned int numViews, unsigned int numSlices, unsigned int numPartitions)
+  {
+    m_filterViews = numViews;
+    m_filterSlices = numSlices;
+    m_filterPartitions = numPartitions;
+  }
+
+
+  /**
+   * Gather per-channel, per-slice QA statistics during the conversion and
+   * write them after the data. outlierSigma = 0 disables them.
+   *
+   * @param outlierSigma outlier threshold in multiples of rec_std
+   * @param maxOutliers outliers allowed per channel and slice before the
+   *                    conversion fails (std::numeric_limits<size_t>::max() for no limit)
+   */
+  void GERawConverter::setQaStatistics(float outlierSigma, size_t maxOutliers)
+  {
+    m_qaSigma = outlierSigma;
+    m_qaMaxOutliers = maxOutliers;
+  }
+
+
+  /**
+   * Returns the size in bytes of the real or imaginary part of a sample as
+   * stored in the P-file
+   */
+  int GERawConverter::storedSampleSize()
+  {
+    const GERecon::Legacy::LxDownloadDataPointer lxDownloadDataPtr =
+      boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(m_downloadDataPtr);
+    return lxDownloadDataPtr->RawHeader().rdb_hdr_point_size;
+  }
+
+
+  /**
+   * Returns the factor that converts the stored integer samples into the
+   * float k-space Orchestra reads, measured once on the first matrix of
+   * the file; 1 for float files, 0 when no single factor was found
+   */
+  double GERawConverter::storedSampleScale()
+  {
+    if (m_storedSampleScale >= 0)
+      return m_storedSampleScale;
+
+    bool zEncoded = m_pfile->IsZEncoded();
+    switch (storedSampleSize()) {
+    case 2:
+      m_storedSampleScale = zEncoded ? measureSampleScale<short, true>() : measureSampleScale<short, false>();
+      break;
+    case 4:
+      m_storedSampleScale = zEncoded ? measureSampleScale<int, true>() : measureSampleScale<int, false>();
+      break;
+    default:
+      m_storedSampleScale = 1.0;
+    }
+
+    if (m_storedSampleScale == 0)
+      m_log << "No single scale from stored samples to float k-space, reading k-space as float" << std::endl;
+    return m_storedSampleScale;
+  }
+
+
+  /**
+   * Compares the first k-space matrix read as T with the same matrix read
+   * as float
+   *
+   * @returns float / T, or 0 when that ratio is not the same for all samples
+   *          or the matrix is empty
+   */
+  template <typename T, bool ZEncoded>
+    double GERawConverter::measureSampleScale()
+  {
+    size_t lenFrame = (size_t) m_processingControl->Value<int>("AcquiredXRes");
+    size_t numViews = (size_t) m_processingControl->Value<int>("AcquiredYRes");
+
+    std::vector<std::complex<float> > stored(lenFrame * numViews), converted(lenFrame * numViews);
+    widenKSpace(readKSpace<T, ZEncoded>(*m_pfile, m_orchestraMutex, 0, 0, 0, 0), lenFrame, 0, numViews, &stored[0]);
+    widenKSpace(readKSpace<float, ZEncoded>(*m_pfile, m_orchestraMutex, 0, 0, 0, 0), lenFrame, 0, numViews,
+                &converted[0]);
+
+    const float* storedValues = reinterpret_cast<const float*>(&stored[0]);
+    const float* convertedValues = reinterpret_cast<const float*>(&converted[0]);
+    size_t numValues = 2 * stored.size();
+
+    double scale = 0;
+    for (size_t i = 0; i < numValues && scale == 0; i++)
+      if (storedValues[i] != 0)
+        scale = (double) convertedValues[i] / storedValues[i];
+    // an empty matrix gives no evidence either way
+    if (scale == 0)
+      return 0;
+
+    for (size_t i = 0; i < numValues; i++)
+      if (std::abs(convertedValues[i] - scale * storedValues[i]) > 1e-6 * std::abs(convertedValues[i]))
+        return 0;
+    return scale;
+  }
+
+
+  /**
+   * Returns the sample type written for dense P-file k-space: "int16" or
+   * "int32" when native samples are kept, otherwise "float"
+   */
+  std::string GERawConverter::nativeSampleType()
+  {
+    if (!m_nativeSamples || m_isScanArchive || m_isRDS || m_filterViews > 0 || m_hybridSpace || m_sparse)
+      return "float";
+
+    // samples that do not convert to float by one factor are stored as float
+    if (storedSampleScale() == 0)
+      return "float";
+
+    switch (storedSampleSize()) {
+    case 2:
+      return "int16";
+    case 4:
+      return "int32";
+    default:
+      return "float";
+    }
+  }
+
+
+  /**
+   * Specify the thread pool used by all conversion stages. Sharing one pool
+   * between converters keeps the total thread count bounded.
+   */
+  void GERawConverter::setThreadPool(std::shared_ptr<ThreadPool> threadPool)
+  {
+    m_threadPool = threadPool;
+  }
+
+
+  /**
+   * Returns the thread pool, creating one that uses all available cores
+   * when none was set
+   */
+  ThreadPool& GERawConverter::threadPool()
+  {
+    if (!m_threadPool)
+      m_threadPool = std::make_shared<ThreadPool>();
+    return *m_threadPool;
+  }
+
+
+  /**
+   * Sets up the QA statistics for a conversion, unless they are disabled
+   * or only part of the data is converted
+   *
+   * @param sampleScale float k-space value of one unit of the samples the
+   *                    statistics are gathered on
+   */
+  void GERawConverter::startQa(size_t numSlices, double sampleScale)
+  {
+    m_qa.reset();
+    if (m_qaSigma <= 0 || m_filterViews > 0)
+      return;
+
+    auto lxDownloadDataPtr =  boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(m_downloadDataPtr);
+    const GERecon::Legacy::PrescanHeaderStruct& prescanHeader = lxDownloadDataPtr->PrescanHeader();
+    unsigned int numChannels = (unsigned int) m_processingControl->Value<int>("NumChannels");
+
+    std::vector<float> recStd(numChannels);
+    for (unsigned int i_channel = 0; i_channel < numChannels; i_channel++)
+      recStd[i_channel] = prescanHeader.rec_std[i_channel];
+    m_qa = std::make_shared<QaStatistics>(recStd, numSlices, m_qaSigma, m_qaMaxOutliers, sampleScale);
+  }
+
+
   ISMRMRD::IsmrmrdHeader GERawConverter::lxDownloadDataToIsmrmrdHeader()
   {
     const GERecon::Legacy::LxDownloadDataPointer lxDownloadDataPtr =
@@ -157,8 +504,6 @@ namespace GeToIsmrmrd {
     const boost::shared_ptr<GERecon::Legacy::LxControlSource> controlSource =
       boost::make_shared<GERecon::Legacy::LxControlSource>(lxDownloadDataPtr);
 
-    bool anonData = !m_anonString.empty();
-
     GERecon::Legacy::DicomSeries legacySeries(lxDownloadDataPtr);
     GEDicom::SeriesPointer series = legacySeries.Series();
     GEDicom::SeriesModulePointer seriesModule = series->GeneralModule();
@@ -180,67 +525,48 @@ namespace GeToIsmrmrd {
     ISMRMRD::IsmrmrdHeader ismrmrd_header;
     ismrmrd_header.version = ISMRMRD_XMLHDR_VERSION;
 
-    if (anonData) {
-      m_log << "  Anonymizing dataset (" << m_anonString << ")..." << std::endl;
-    }
-
     m_log << "  Loading subject information..." << std::endl;
     ISMRMRD::SubjectInformation subjectInformation;
-    if (anonData) {
-      subjectInformation.patientName = m_anonString;
-      subjectInformation.patientID = m_anonString;
-    }
-    else {
-      subjectInformation.patientName = patientModule->Name().c_str();
-      subjectInformation.patientWeight_kg = std::stof(patientStudyModule->Weight());
-      subjectInformation.patientID = patientModule->ID().c_str();
-      if (!patientModule->Birthdate().empty())
-        subjectInformation.patientBirthdate = convert_date(patientModule->Birthdate()).c_str();
-    }
+    subjectInformation.patientName = patientModule->Name().c_str();
+    std::string weight = patientStudyModule->Weight();
+    char* weightEnd = NULL;
+    float weight_kg = std::strtof(weight.c_str(), &weightEnd);
+    if (!weight.empty() && weightEnd != weight.c_str())
+      subjectInformation.patientWeight_kg = weight_kg;
+    subjectInformation.patientID = patientModule->ID().c_str();
+    if (!patientModule->Birthdate().empty())
+      subjectInformation.patientBirthdate = convert_date(patientModule->Birthdate()).c_str();
     if (!patientModule->Gender().empty())
       subjectInformation.patientGender = patientModule->Gender().c_str();
     ismrmrd_header.subjectInformation = subjectInformation;
 
     m_log << "  Loading study information..." << std::endl;
     ISMRMRD::StudyInformation studyInformation;
-    if (anonData) {
-      studyInformation.studyID = m_anonString;
-      studyInformation.studyDescription = m_anonString;
-      studyInformation.studyInstanceUID = m_anonString;
-    }
-    else {
-      if (!studyModule->Date().empty())
-        studyInformation.studyDate = convert_date(studyModule->Date()).c_str();
-      studyInformation.studyTime = convert_time(studyModule->Time()).c_str();
-      studyInformation.studyID = std::to_string(studyModule->StudyNumber());
-      studyInformation.accessionNumber = std::strtol(studyModule->AccessionNumber().c_str(), NULL, 0);
-      studyInformation.referringPhysicianName = studyModule->ReferringPhysician().c_str();
-      studyInformation.studyDescription = studyModule->StudyDescription().c_str();
-      studyInformation.studyInstanceUID = studyModule->UID().c_str();
-    }
+    if (!studyModule->Date().empty())
+      studyInformation.studyDate = convert_date(studyModule->Date()).c_str();
+    studyInformation.studyTime = convert_time(studyModule->Time()).c_str();
+    studyInformation.studyID = std::to_string(studyModule->StudyNumber());
+    studyInformation.accessionNumber = std::strtol(studyModule->AccessionNumber().c_str(), NULL, 0);
+    studyInformation.referringPhysicianName = studyModule->ReferringPhysician().c_str();
+    studyInformation.studyDescription = studyModule->StudyDescription().c_str();
+    studyInformation.studyInstanceUID = studyModule->UID().c_str();
     ismrmrd_header.studyInformation = studyInformation;
     //writer->formatElement("ReadingPhysician", "%s", studyModule->ReadingPhysician().c_str());
 
     m_log << "  Loading measurement information..." << std::endl;
     ISMRMRD::MeasurementInformation measurementInformation;
-    if (anonData) {
-      measurementInformation.protocolName = m_anonString;
-      measurementInformation.seriesDescription = m_anonString;
-      measurementInformation.seriesInstanceUIDRoot = m_anonString;
-    } else {
-      // measurementInformation.measurementID = lxDownloadDataPtr->SeriesNumber();
-      if (!seriesModule->Date().empty())
-        measurementInformation.seriesDate = convert_date(seriesModule->Date()).c_str();
-      measurementInformation.seriesTime = convert_time(seriesModule->Time()).c_str();
-      measurementInformation.protocolName = seriesModule->ProtocolName().c_str();
-      measurementInformation.seriesDescription = seriesModule->SeriesDescription().c_str();
-      //measurementInformation.measurementDependency = ?
-      measurementInformation.seriesInstanceUIDRoot = seriesModule->UID().c_str();
-      // measurementInformation.frameOfReferenceUID = ?
-      // measurementInformation.referencedImageSequence = ?
-      // writer->formatElement("Laterality", "%s", seriesModule->Laterality().c_str());
-      // writer->formatElement("OperatorName", "%s", seriesModule->OperatorName().c_str());
-    }
+    // measurementInformation.measurementID = lxDownloadDataPtr->SeriesNumber();
+    if (!seriesModule->Date().empty())
+      measurementInformation.seriesDate = convert_date(seriesModule->Date()).c_str();
+    measurementInformation.seriesTime = convert_time(seriesModule->Time()).c_str();
+    measurementInformation.protocolName = seriesModule->ProtocolName().c_str();
+    measurementInformation.seriesDescription = seriesModule->SeriesDescription().c_str();
+    //measurementInformation.measurementDependency = ?
+    measurementInformation.seriesInstanceUIDRoot = seriesModule->UID().c_str();
+    // measurementInformation.frameOfReferenceUID = ?
+    // measurementInformation.referencedImageSequence = ?
+    // writer->formatElement("Laterality", "%s", seriesModule->Laterality().c_str());
+    // writer->formatElement("OperatorName", "%s", seriesModule->OperatorName().c_str());
     measurementInformation.initialSeriesNumber = lxDownloadDataPtr->SeriesNumber();
     GERecon::PatientPosition patientPosition = static_cast<GERecon::PatientPosition>(
       m_processingControl->Value<int>("PatientPosition"));
@@ -369,6 +695,16 @@ namespace GeToIsmrmrd {
     userParameters.userParameterString.push_back({"PSDName", imageHeader.psdname});
     userParameters.userParameterString.push_back({"PSDNameInternal", imageHeader.psd_iname});
     userParameters.userParameterString.push_back({"History", patientStudyModule->History().c_str()});
+    userParameters.userParameterString.push_back({"KSpaceSampleType", nativeSampleType()});
+    if (nativeSampleType() != "float")
+      userParameters.userParameterDouble.push_back({"KSpaceSampleScale", storedSampleScale()});
+    if (m_hybridSpace) {
+      userParameters.userParameterString.push_back({"ReadoutSpace", "image"});
+      if (!m_isScanArchive && !m_isRDS && !m_sparse)
+        userParameters.userParameterString.push_back({"HybridLayout", "view,slice,channel,x"});
+    }
+    if (m_sparse && !m_isScanArchive && !m_isRDS)
+      userParameters.userParameterString.push_back({"KSpaceStorage", "acquired views"});
 
     userParameters.userParameterLong.push_back({.name = "ChopX", .value = m_processingControl->Value<bool>("ChopX")});
     userParameters.userParameterLong.push_back({.name = "ChopY", .value = m_processingControl->Value<bool>("ChopY")});
@@ -479,6 +815,11 @@ namespace GeToIsmrmrd {
 
     ismrmrd_header.userParameters = userParameters;
 
+    if (!m_anonString.empty()) {
+      m_log << "  Anonymizing dataset (" << m_anonString << ")..." << std::endl;
+      anonymizeIsmrmrdHeader(ismrmrd_header, m_anonString);
+    }
+
     /*
     writer->formatElement("ImageType", "%s", imageModule->ImageType().c_str());
     writer->formatElement("ScanSequence", "%s", imageModule->ScanSequence().c_str());
@@ -560,21 +901,51 @@ namespace GeToIsmrmrd {
   } // function lxDownloadDataToXML()
 
 
-  size_t GERawConverter::appendAcquisitions(ISMRMRD::Dataset& d)
+  size_t GERawConverter::appendAcquisitions(ConversionSink& sink)
   {
-    size_t numData = 0 ; //appendNoiseInformation(d);
+    size_t numData = 0 ; //appendNoiseInformation(sink);
     if (m_isScanArchive)
-      return numData + appendAcquisitionsFromArchive(d);
+      numData += appendAcquisitionsFromArchive(sink);
     else {
       if (m_isRDS)
-        return numData + appendAcquisitionsFromPfile(d);
+        numData += appendAcquisitionsFromPfile(sink);
       else
-        return numData + appendImagesFromPfile(d);
+        numData += appendImagesFromPfile(sink);
     }
+
+    // QA statistics go next to rec_std/rec_mean
+    if (m_qa) {
+      m_qa->append(sink);
+      m_qa.reset();
+    }
+    return numData;
   } // function GERawConverter::appendAcquisitions()
 
 
-  size_t GERawConverter::appendNoiseInformation(ISMRMRD::Dataset &d)
+  /**
+   * Dataset overloads, writing through a DatasetSink. appendAcquisitions()
+   * completes the sink, which stores the acquisition index.
+   */
+  size_t GERawConverter::appendAcquisitions(ISMRMRD::Dataset& d)
+  {
+    DatasetSink sink(d);
+    size_t numData = appendAcquisitions(sink);
+    sink.onComplete();
+    return numData;
+  }
+
+
+  /**
+   * Noise information holds no acquisitions, so no index is written
+   */
+  size_t GERawConverter::appendNoiseInformation(ISMRMRD::Dataset& d)
+  {
+    DatasetSink sink(d);
+    return appendNoiseInformation(sink);
+  }
+
+
+  size_t GERawConverter::appendNoiseInformation(ConversionSink& sink)
   {
     auto lxDownloadDataPtr =  boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(m_downloadDataPtr);
     const GERecon::Legacy::LxDownloadData& lxDownloadData = *lxDownloadDataPtr.get();
@@ -590,18 +961,53 @@ namespace GeToIsmrmrd {
       recMean(i_channel) = prescanHeader.rec_mean[i_channel];
     }
 
-    d.appendNDArray("rec_std", recStd);
-    d.appendNDArray("rec_mean", recMean);
+    sink.onNoise("rec_std", recStd);
+    sink.onNoise("rec_mean", recMean);
 
     return 2;
   }
 
 
-  size_t GERawConverter::appendImagesFromPfile(ISMRMRD::Dataset& d)
+  size_t GERawConverter::appendImagesFromPfile(ConversionSink& sink)
   {
     if (m_isScanArchive)
       return 0;
 
+    // Sample type and slice ordering are fixed per file, so they are
+    // resolved once here; the copy loops are compiled for each combination.
+    // The stored sample scale is only measured when native samples are
+    // requested.
+    bool zEncoded = m_pfile->IsZEncoded();
+
+    std::string sampleType = nativeSampleType();
+    if (sampleType == "int16")
+      return zEncoded ? appendNativeImagesFromPfile<short, true>(sink) : appendNativeImagesFromPfile<short, false>(sink);
+    else if (sampleType == "int32")
+      return zEncoded ? appendNativeImagesFromPfile<int, true>(sink) : appendNativeImagesFromPfile<int, false>(sink);
+
+    // Orchestra's float read applies any scaling of the stored samples
+    return zEncoded ? appendKSpaceFromPfile<float, true>(sink) : appendKSpaceFromPfile<float, false>(sink);
+  } // function GERawConverter::appendImagesFromPfile()
+
+
+  /**
+   * Stores dense P-file k-space read as samples of type T as complex float
+   */
+  template <typename T, bool ZEncoded>
+    size_t GERawConverter::appendKSpaceFromPfile(ConversionSink& sink)
+  {
+    if (m_sparse && m_filterViews == 0) {
+      if (m_processingControl->Value<bool>("Is3DAcquisition"))
+        return appendSparseFromPfile<T, ZEncoded, true>(sink);
+      return appendSparseFromPfile<T, ZEncoded, false>(sink);
+    }
+
+    if (m_hybridSpace && m_filterViews == 0)
+      return appendHybridFromPfile<T, ZEncoded>(sink);
+
+    if (m_nativeSamples)
+      m_log << "Native samples unavailable, storing k-space as complex float" << std::endl;
+
     //const GERecon::Control::ProcessingControlPointer processingControl(m_pfile->CreateOrchestraProcessingControl());
     //auto lxDownloadDataPtr =  boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(m_downloadDataPtr);
 
@@ -612,11 +1018,23 @@ namespace GeToIsmrmrd {
     unsigned int numEchoes = (unsigned int) m_processingControl->Value<int>("NumEchoes");
     unsigned int numPhases = (unsigned int) m_processingControl->Value<int>("NumPhases");
 
+    // with a view filter only the central views of the middle slices are read
+    size_t firstView = 0, numKeptViews = numViews;
+    size_t firstSlice = 0, numKeptSlices = numSlices;
+    if (m_filterViews > 0) {
+      bool is3D = m_processingControl->Value<bool>("Is3DAcquisition");
+      centralRange(numViews, m_filterViews, firstView, numKeptViews);
+      centralRange(numSlices, is3D ? m_filterPartitions : m_filterSlices, firstSlice, numKeptSlices);
+      numEchoes = 1;
+      numPhases = 1;
+    }
+
+    startQa(numSlices);
     size_t numVolumes = 0;
 
     for (unsigned int i_phase = 0; i_phase < numPhases; i_phase++) {
       for (unsigned int i_echo = 0; i_echo < numEchoes; i_echo++) {
-        ISMRMRD::Image<std::complex<float> > kspace(lenFrame, numViews, numSlices, numChannels);
+        ISMRMRD::Image<std::complex<float> > kspace(lenFrame, numKeptViews, numKeptSlices, numChannels);
         kspace.setImageType(ISMRMRD::ISMRMRD_ImageTypes::ISMRMRD_IMTYPE_COMPLEX);
         kspace.setContrast(i_echo);
         kspace.setPhase(i_phase);
@@ -624,40 +1042,262 @@ namespace GeToIsmrmrd {
 
         // Pfile is stored as (readout, views, echoes, slice, channel)
         m_log << "Reading volume (Echo: " << i_echo << ", Phase: " << i_phase << ")..." << std::endl;
-#pragma omp parallel for collapse(2)
-        for (unsigned int i_channel = 0; i_channel < numChannels; i_channel++) {
-          for (unsigned int i_slice = 0; i_slice < numSlices; i_slice++) {
-            MDArray::ComplexFloatMatrix kspaceFromFile;
-            if (m_pfile->IsZEncoded()) {
-              auto kSpaceRead = m_pfile->KSpaceData<float>(
-                GERecon::Legacy::Pfile::PassSlicePair(i_phase, i_slice), i_echo, i_channel);
-              kspaceFromFile.reference(kSpaceRead);
-            }
-            else {
-              auto kSpaceRead = m_pfile->KSpaceData<float>(i_slice, i_echo, i_channel, i_phase);
-              kspaceFromFile.reference(kSpaceRead);
-            }
+        threadPool().parallelFor(numChannels * numKeptSlices, [&](size_t i_task) {
+          unsigned int i_channel = i_task / numKeptSlices;
+          unsigned int i_slice = firstSlice + i_task % numKeptSlices;
+
+          // the slice and channel are one contiguous block of the volume
+          MDArray::Array<std::complex<T>, 2> kspaceFromFile =
+            readKSpace<T, ZEncoded>(*m_pfile, m_orchestraMutex, i_slice, i_echo, i_channel, i_phase);
+          widenKSpace(kspaceFromFile, lenFrame, firstView, numKeptViews,
+                      &kspace(0, 0, i_slice - firstSlice, i_channel));
+
+          // the slice was just copied and is still in cache
+          if (m_qa)
+            m_qa->accumulator(i_channel, i_slice).add(
+              reinterpret_cast<const float*>(&kspace(0, 0, i_slice - firstSlice, i_channel)),
+              (size_t) lenFrame * numKeptViews, m_qa->outlierThreshold(i_channel));
+        }); // parallelFor (i_channel, i_slice)
+        if (m_qa)
+          m_qa->check();
+        sink.onImage("kspace", kspace);
+        numVolumes++;
+      } // for (i_echo)
+    } // for (i_phase)
+
+    return numVolumes;
+  } // function GERawConverter::appendKSpaceFromPfile()
+
+
+  /**
+   * Stores dense P-file k-space with the integer sample type of the file.
+   * ISMRMRD has no complex integer images, so each volume is written as a
+   * T image of size (2 * readout, views, slices, channels) with real and
+   * imaginary parts interleaved along the readout, as a REAL image whose
+   * meta data records the layout. The header's KSpaceSampleScale converts
+   * samples back to float.
+   */
+  template <typename T, bool ZEncoded>
+    size_t GERawConverter::appendNativeImagesFromPfile(ConversionSink& sink)
+  {
+    unsigned int lenFrame = (unsigned int) m_processingControl->Value<int>("AcquiredXRes");
+    unsigned int numViews = (unsigned int) m_processingControl->Value<int>("AcquiredYRes");
+    unsigned int numSlices = (unsigned int) m_processingControl->Value<int>("AcquiredZRes");
+    unsigned int numChannels = (unsigned int) m_processingControl->Value<int>("NumChannels");
+    unsigned int numEchoes = (unsigned int) m_processingControl->Value<int>("NumEchoes");
+    unsigned int numPhases = (unsigned int) m_processingControl->Value<int>("NumPhases");
+
+    ISMRMRD::MetaContainer meta;
+    meta.set("SampleType", nativeSampleType());
+    meta.set("ComplexStorage", "interleaved");
+    std::stringstream metaStream;
+    ISMRMRD::serialize(meta, metaStream);
+
+    // the statistics are gathered on the stored integers
+    startQa(numSlices, storedSampleScale());
+    size_t numVolumes = 0;
 
-            for (unsigned int i_view = 0; i_view < numViews; i_view++) {
-              for (unsigned int i = 0 ; i < lenFrame ; i++)
-                kspace(i, i_view, i_slice, i_channel) = kspaceFromFile((int)i, (int)i_view);
-            } // for (i_view)
-          } // for (i_slice)
-        } // for (i_channel)
-        d.appendImage("kspace", kspace);
+    for (unsigned int i_phase = 0; i_phase < numPhases; i_phase++) {
+      for (unsigned int i_echo = 0; i_echo < numEchoes; i_echo++) {
+        // real and imaginary parts are separate samples of the image
+        ISMRMRD::Image<T> kspace(2 * lenFrame, numViews, numSlices, numChannels);
+        kspace.setImageType(ISMRMRD::ISMRMRD_ImageTypes::ISMRMRD_IMTYPE_REAL);
+        kspace.setContrast(i_echo);
+        kspace.setPhase(i_phase);
+        kspace.setAttributeString(metaStream.str());
+
+        m_log << "Reading volume (Echo: " << i_echo << ", Phase: " << i_phase
+              << ", " << nativeSampleType() << ")..." << std::endl;
+        threadPool().parallelFor(numChannels * numSlices, [&](size_t i_task) {
+          unsigned int i_channel = i_task / numSlices;
+          unsigned int i_slice = i_task % numSlices;
+
+          MDArray::Array<std::complex<T>, 2> kspaceFromFile =
+            readKSpace<T, ZEncoded>(*m_pfile, m_orchestraMutex, i_slice, i_echo, i_channel, i_phase);
+          interleaveMatrix(kspaceFromFile.data(), kspaceFromFile.stride(0), kspaceFromFile.stride(1),
+                           lenFrame, numViews, &kspace(0, 0, i_slice, i_channel));
+
+          if (m_qa)
+            m_qa->accumulator(i_channel, i_slice).add(&kspace(0, 0, i_slice, i_channel),
+              (size_t) lenFrame * numViews, m_qa->outlierThreshold(i_channel));
+        }); // parallelFor (i_channel, i_slice)
+        if (m_qa)
+          m_qa->check();
+        sink.onImage("kspace", kspace);
         numVolumes++;
       } // for (i_echo)
     } // for (i_phase)
 
     return numVolumes;
-  } // function GERawConverter::appendImagesFromPfile()
+  } // function GERawConverter::appendNativeImagesFromPfile()
+
+
+  /**
+   * Stores dense P-file data in hybrid space. The readout of every view is
+   * inverse Fourier transformed while it is copied, and each volume is
+   * written as a (views, slices, channels, x) array with x outermost, so
+   * every x position is one contiguous block for slice-parallel recon.
+   * Volumes are appended phase by phase, echo by echo.
+   */
+  template <typename T, bool ZEncoded>
+    size_t GERawConverter::appendHybridFromPfile(ConversionSink& sink)
+  {
+    unsigned int lenFrame = (unsigned int) m_processingControl->Value<int>("AcquiredXRes");
+    unsigned int numViews = (unsigned int) m_processingControl->Value<int>("AcquiredYRes");
+    unsigned int numSlices = (unsigned int) m_processingControl->Value<int>("AcquiredZRes");
+    unsigned int numChannels = (unsigned int) m_processingControl->Value<int>("NumChannels");
+    unsigned int numEchoes = (unsigned int) m_processingControl->Value<int>("NumEchoes");
+    unsigned int numPhases = (unsigned int) m_processingControl->Value<int>("NumPhases");
 
+    std::vector<size_t> dims = {numViews, numSlices, numChannels, lenFrame};
+    size_t xStride = (size_t) numViews * numSlices * numChannels;
 
-  size_t GERawConverter::appendAcquisitionsFromPfile(ISMRMRD::Dataset& d)
+    startQa(numSlices);
+    size_t numVolumes = 0;
+
+    for (unsigned int i_phase = 0; i_phase < numPhases; i_phase++) {
+      for (unsigned int i_echo = 0; i_echo < numEchoes; i_echo++) {
+        ISMRMRD::NDArray<std::complex<float> > hybrid(dims);
+        std::complex<float>* hybridData = hybrid.getDataPtr();
+
+        m_log << "Reading volume (Echo: " << i_echo << ", Phase: " << i_phase << ", hybrid space)..." << std::endl;
+        threadPool().parallelFor(numChannels * numSlices, [&](size_t i_task) {
+          unsigned int i_channel = i_task / numSlices;
+          unsigned int i_slice = i_task % numSlices;
+
+          MDArray::Array<std::complex<T>, 2> kspaceFromFile =
+            readKSpace<T, ZEncoded>(*m_pfile, m_orchestraMutex, i_slice, i_echo, i_channel, i_phase);
+
+          FftPlan& plan = FftPlan::threadPlan(lenFrame);
+          std::vector<std::complex<float> > readout(lenFrame);
+          std::complex<float>* block = hybridData + (i_channel * numSlices + i_slice) * numViews;
+          for (unsigned int i_view = 0; i_view < numViews; i_view++) {
+            widenKSpace(kspaceFromFile, lenFrame, i_view, 1, &readout[0]);
+            if (m_qa)
+              m_qa->accumulator(i_channel, i_slice).add(reinterpret_cast<const float*>(&readout[0]),
+                lenFrame, m_qa->outlierThreshold(i_channel));
+            plan.inverseCentered(&readout[0]);
+            for (unsigned int x = 0 ; x < lenFrame ; x++)
+              block[x * xStride + i_view] = readout[x];
+          } // for (i_view)
+        }); // parallelFor (i_channel, i_slice)
+        if (m_qa)
+          m_qa->check();
+        sink.onArray("hybrid", hybrid);
+        numVolumes++;
+      } // for (i_echo)
+    } // for (i_phase)
+
+    return numVolumes;
+  } // function GERawConverter::appendHybridFromPfile()
+
+
+  /**
+   * Stores dense P-file k-space as one acquisition per acquired view and
+   * slice. A view counts as acquired when any channel has a nonzero sample
+   * in it, so lines left empty by partial Fourier, ZIP or undersampling are
+   * neither kept in memory nor written. Slices are read in parallel and
+   * appended in order, volume by volume.
+   */
+  template <typename T, bool ZEncoded, bool Is3D>
+    size_t GERawConverter::appendSparseFromPfile(ConversionSink& sink)
+  {
+    auto lxDownloadDataPtr =  boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(m_downloadDataPtr);
+    float bandwidth = lxDownloadDataPtr->RawHeader().rdb_hdr_bw;
+    float sample_time_us = 1.0 / (bandwidth * 1e-3);
+
+    unsigned int lenFrame = (unsigned int) m_processingControl->Value<int>("AcquiredXRes");
+    unsigned int numViews = (unsigned int) m_processingControl->Value<int>("AcquiredYRes");
+    unsigned int numSlices = (unsigned int) m_processingControl->Value<int>("AcquiredZRes");
+    unsigned int numChannels = (unsigned int) m_processingControl->Value<int>("NumChannels");
+    unsigned int numEchoes = (unsigned int) m_processingControl->Value<int>("NumEchoes");
+    unsigned int numPhases = (unsigned int) m_processingControl->Value<int>("NumPhases");
+
+    startQa(numSlices);
+    size_t numAcquisitions = 0;
+
+    for (unsigned int i_phase = 0; i_phase < numPhases; i_phase++) {
+      for (unsigned int i_echo = 0; i_echo < numEchoes; i_echo++) {
+        std::vector<std::vector<ISMRMRD::Acquisition> > acquisitions(numSlices);
+
+        m_log << "Reading volume (Echo: " << i_echo << ", Phase: " << i_phase << ", acquired views)..." << std::endl;
+        threadPool().parallelFor(numSlices, [&](size_t i_slice) {
+          // one slice as (readout, view, channel)
+          std::vector<std::complex<float> > slab((size_t) lenFrame * numViews * numChannels);
+          std::vector<char> acquired(numViews, 0);
+
+          for (unsigned int i_channel = 0; i_channel < numChannels; i_channel++) {
+            std::complex<float>* channelSlab = &slab[(size_t) i_channel * numViews * lenFrame];
+            MDArray::Array<std::complex<T>, 2> kspaceFromFile =
+              readKSpace<T, ZEncoded>(*m_pfile, m_orchestraMutex, i_slice, i_echo, i_channel, i_phase);
+            widenKSpace(kspaceFromFile, lenFrame, 0, numViews, channelSlab);
+
+            for (unsigned int i_view = 0; i_view < numViews; i_view++)
+              acquired[i_view] |= anyNonzero(channelSlab + (size_t) i_view * lenFrame, lenFrame);
+          } // for (i_channel)
+
+          std::vector<ISMRMRD::Acquisition>& sliceAcquisitions = acquisitions[i_slice];
+          sliceAcquisitions.resize(std::count(acquired.begin(), acquired.end(), 1));
+          size_t i_acq = 0;
+          for (unsigned int i_view = 0; i_view < numViews; i_view++) {
+            if (!acquired[i_view])
+              continue;
+
+            ISMRMRD::Acquisition& ismrmrd_acq = sliceAcquisitions[i_acq++];
+            ismrmrd_acq.resize(lenFrame, numChannels);
+            ismrmrd_acq.idx().kspace_encode_step_1 = i_view;
+            setSliceCounters<Is3D>(ismrmrd_acq, i_slice);
+            ismrmrd_acq.idx().contrast = i_echo;
+            ismrmrd_acq.idx().phase = i_phase;
+            ismrmrd_acq.discard_pre() = 0;
+            ismrmrd_acq.discard_post() = 0;
+            ismrmrd_acq.sample_time_us() = sample_time_us;
+
+            for (unsigned int i_channel = 0; i_channel < numChannels; i_channel++) {
+              const std::complex<float>* line = &slab[((size_t) i_channel * numViews + i_view) * lenFrame];
+              std::copy(line, line + lenFrame, ismrmrd_acq.getDataPtr() + (size_t) i_channel * lenFrame);
+              if (m_qa)
+                m_qa->accumulator(i_channel, i_slice).add(reinterpret_cast<const float*>(line),
+                  lenFrame, m_qa->outlierThreshold(i_channel));
+            }
+            if (m_hybridSpace)
+              readoutToImageSpace(ismrmrd_acq, lenFrame, numChannels);
+          } // for (i_view)
+
+          if (!sliceAcquisitions.empty()) {
+            sliceAcquisitions.front().setFlag(ISMRMRD::ISMRMRD_ACQ_FIRST_IN_SLICE);
+            sliceAcquisitions.back().setFlag(ISMRMRD::ISMRMRD_ACQ_LAST_IN_SLICE);
+          }
+        }); // parallelFor (i_slice)
+        if (m_qa)
+          m_qa->check();
+
+        size_t numVolumeAcquisitions = 0;
+        for (unsigned int i_slice = 0; i_slice < numSlices; i_slice++) {
+          for (size_t i_acq = 0; i_acq < acquisitions[i_slice].size(); i_acq++) {
+            acquisitions[i_slice][i_acq].scan_counter() = numAcquisitions++;
+            sink.onAcquisition(acquisitions[i_slice][i_acq]);
+          }
+          numVolumeAcquisitions += acquisitions[i_slice].size();
+        }
+        m_log << "Stored " << numVolumeAcquisitions << " of " << (size_t) numViews * numSlices
+              << " views" << std::endl;
+      } // for (i_echo)
+    } // for (i_phase)
+
+    return numAcquisitions;
+  } // function GERawConverter::appendSparseFromPfile()
+
+
+  size_t GERawConverter::appendAcquisitionsFromPfile(ConversionSink& sink)
   {
     if (m_isScanArchive)
       return 0;
 
+    // RDS views carry no encoding indices to filter on
+    if (m_filterViews > 0)
+      throw std::runtime_error("View filtering is not supported for RDS P-files");
+
     const GERecon::Control::ProcessingControlPointer processingControl(m_pfile->CreateOrchestraProcessingControl());
     auto lxDownloadDataPtr =  boost::dynamic_pointer_cast<GERecon::Legacy::LxDownloadData>(m_downloadDataPtr);
     const GERecon::Legacy::LxDownloadData& lxDownloadData = *lxDownloadDataPtr.get();
@@ -672,31 +1312,73 @@ namespace GeToIsmrmrd {
     size_t numViews = m_pfile->ViewCount();
     m_log << "Number of views: " << numViews << std::endl;
 
-    for (size_t i_view = 0; i_view < numViews; i_view++) {
-      ISMRMRD::Acquisition ismrmrd_acq;
-      ismrmrd_acq.resize(lenFrame, numChannels);
-      ismrmrd_acq.scan_counter() = i_view;
-      ismrmrd_acq.discard_pre() = 0;
-      ismrmrd_acq.discard_post() = 0;
-      ismrmrd_acq.sample_time_us() = sample_time_us;
-
-#pragma omp parallel for
-      for (size_t i_channel = 0; i_channel < numChannels; i_channel++) {
-        MDArray::ComplexFloatVector kspaceFromFile = m_pfile->ViewData<float>(i_view, i_channel);
-        for (unsigned int i_readout = 0; i_readout < lenFrame; i_readout++) {
-          ismrmrd_acq.data(i_readout, i_channel) = kspaceFromFile(i_readout);
+    // RDS views carry no slice index
+    startQa(1);
+
+    // views are read in parallel and appended in order, one batch at a time
+    for (size_t i_first = 0; i_first < numViews; i_first += ACQUISITION_BATCH_SIZE) {
+      size_t numBatch = std::min(ACQUISITION_BATCH_SIZE, numViews - i_first);
+      std::vector<ISMRMRD::Acquisition> acquisitions(numBatch);
+      // per-view QA partials, merged in order after the batch
+      std::vector<QaAccumulator> qaPartials(m_qa ? numBatch * numChannels : 0);
+
+      threadPool().parallelFor(numBatch, [&](size_t i_batch) {
+        size_t i_view = i_first + i_batch;
+        ISMRMRD::Acquisition& ismrmrd_acq = acquisitions[i_batch];
+        ismrmrd_acq.resize(lenFrame, numChannels);
+        ismrmrd_acq.scan_counter() = i_view;
+        ismrmrd_acq.discard_pre() = 0;
+        ismrmrd_acq.discard_post() = 0;
+        ismrmrd_acq.sample_time_us() = sample_time_us;
+
+        for (size_t i_channel = 0; i_channel < numChannels; i_channel++) {
+          MDArray::ComplexFloatVector kspaceFromFile;
+          {
+            std::lock_guard<std::mutex> lock(m_orchestraMutex);
+            kspaceFromFile.reference(m_pfile->ViewData<float>(i_view, i_channel));
+          }
+          widenReadout(kspaceFromFile.data(), kspaceFromFile.stride(0), lenFrame,
+                       ismrmrd_acq.getDataPtr() + i_channel * lenFrame);
+          if (m_qa)
+            qaPartials[i_batch * numChannels + i_channel].add(
+              reinterpret_cast<const float*>(ismrmrd_acq.getDataPtr() + i_channel * lenFrame),
+              lenFrame, m_qa->outlierThreshold(i_channel));
         }
+        if (m_hybridSpace)
+          readoutToImageSpace(ismrmrd_acq, lenFrame, numChannels);
+      }); // parallelFor (i_view)
+
+      if (m_qa) {
+        for (size_t i_partial = 0; i_partial < qaPartials.size(); i_partial++)
+          m_qa->accumulator(i_partial % numChannels, 0).merge(qaPartials[i_partial]);
+        m_qa->check();
       }
-      d.appendAcquisition(ismrmrd_acq);
+
+      for (size_t i_batch = 0; i_batch < numBatch; i_batch++)
+        sink.onAcquisition(acquisitions[i_batch]);
     }
 
     return numViews;
   } // function GERawConverter::appendAcquisitionsFromPfile()
 
-  size_t GERawConverter::appendAcquisitionsFromArchive(ISMRMRD::Dataset& d) {
+  size_t GERawConverter::appendAcquisitionsFromArchive(ConversionSink& sink) {
     if (!m_isScanArchive)
       return 0;
 
+    // slices or partitions are fixed per file
+    if (m_processingControl->Value<bool>("Is3DAcquisition"))
+      return appendFramesFromArchive<true>(sink);
+    return appendFramesFromArchive<false>(sink);
+  }
+
+
+  /**
+   * Appends the frames of a ScanArchive; the slice number of a frame is a
+   * partition when Is3D
+   */
+  template <bool Is3D>
+    size_t GERawConverter::appendFramesFromArchive(ConversionSink& sink)
+  {
     GERecon::Acquisition::ArchiveStoragePointer archiveStorage =
       GERecon::Acquisition::ArchiveStorage::Create(m_scanArchive);
     const GERecon::Legacy::LxDownloadDataPointer lxDownloadDataPtr =
@@ -707,15 +1389,31 @@ namespace GeToIsmrmrd {
     const size_t numControls = archiveStorage->AvailableControlCount();
     int lenReadout = m_processingControl->Value<int>("AcquiredXRes");
     int numChannels = m_processingControl->Value<int>("NumChannels");
-    bool is3D = m_processingControl->Value<bool>("Is3DAcquisition");
     float bandwidth = rdbHeader.rdb_hdr_bw;
     float sample_time_us = 1.0 / (bandwidth * 1e-3);
 
     //m_log << "Bandwidth" << bandwidth << std::endl;
     size_t i_acquisition = 0;
 
+    // with a view filter only the central views of the middle slices are kept
+    size_t firstView = 0, numKeptViews = 0;
+    size_t firstSlice = 0, numKeptSlices = 0;
+    if (m_filterViews > 0) {
+      centralRange(m_processingControl->Value<int>("AcquiredYRes"), m_filterViews, firstView, numKeptViews);
+      centralRange(m_processingControl->Value<int>("AcquiredZRes"), Is3D ? m_filterPartitions : m_filterSlices,
+                   firstSlice, numKeptSlices);
+    }
+
     m_log << "Num controls: " << numControls << std::endl;
 
+    // partitions take the place of slices for 3D
+    startQa(m_processingControl->Value<int>("AcquiredZRes"));
+
+    // Frames have to be pulled from the archive in order, so only the
+    // per-frame copy runs in parallel, one batch at a time.
+    std::vector<GERecon::Acquisition::FrameControlPointer> frames;
+    frames.reserve(ACQUISITION_BATCH_SIZE);
+
     for(size_t i_control = 0; i_control < numControls; i_control++) {
       const GERecon::Acquisition::FrameControlPointer controlPacketAndFrameData = archiveStorage->NextFrameControl();
       if(controlPacketAndFrameData->Control().Opcode() == GERecon::Acquisition::ProgrammableOpcode) {
@@ -723,45 +1421,86 @@ namespace GeToIsmrmrd {
         const GERecon::Acquisition::ProgrammableControlPacket framePacket =
           controlPacketAndFrameData->Control().Packet().As<GERecon::Acquisition::ProgrammableControlPacket>();
         int viewValue = GERecon::Acquisition::GetPacketValue(framePacket.viewNumH, framePacket.viewNumL);
-        if (viewValue != 0) {
-          ISMRMRD::Acquisition ismrmrd_acq;
-          ismrmrd_acq.resize(lenReadout, numChannels);
-          ismrmrd_acq.idx().contrast = framePacket.echoNum;
-          ismrmrd_acq.idx().kspace_encode_step_1 = viewValue - 1;
-          if (is3D) {
-            ismrmrd_acq.idx().kspace_encode_step_2 = GERecon::Acquisition::GetPacketValue(
-              framePacket.sliceNumH, framePacket.sliceNumL);
-            ismrmrd_acq.idx().slice = 0;
-          }
-          else {
-            ismrmrd_acq.idx().kspace_encode_step_2 = 0;
-            ismrmrd_acq.idx().slice = GERecon::Acquisition::GetPacketValue(
-              framePacket.sliceNumH, framePacket.sliceNumL);
-          }
-          ismrmrd_acq.idx().segment = GERecon::Acquisition::GetPacketValue(
-            framePacket.echoTrainIndexH, framePacket.echoTrainIndexL);
-          ismrmrd_acq.scan_counter() = i_acquisition++;
-          ismrmrd_acq.discard_pre() = 0;
-          ismrmrd_acq.discard_post() = 0;
-          ismrmrd_acq.sample_time_us() = sample_time_us;
-          ismrmrd_acq.user_int()[0] = controlPacketAndFrameData->Control().Opcode();
-
-          const MDArray::ComplexFloatCube frameRawData = controlPacketAndFrameData->Data();
-          if (frameRawData.extent(2) != 1)
-            m_log << "Warning!! Number of frames not equal to 1 for control packet" << std::endl;
+        size_t sliceValue = GERecon::Acquisition::GetPacketValue(framePacket.sliceNumH, framePacket.sliceNumL);
+        bool filteredOut = m_filterViews > 0
+          && (framePacket.echoNum != 0
+              || (size_t) (viewValue - 1) < firstView || (size_t) (viewValue - 1) >= firstView + numKeptViews
+              || sliceValue < firstSlice || sliceValue >= firstSlice + numKeptSlices);
+        if (viewValue != 0 && !filteredOut)
+          frames.push_back(controlPacketAndFrameData);
+      } // if (controlPacketAndFrameData->Contrl().Opcode()...)
+
+      if (frames.empty() || (frames.size() < ACQUISITION_BATCH_SIZE && i_control + 1 < numControls))
+        continue;
+
+      size_t numBatch = frames.size();
+      std::vector<ISMRMRD::Acquisition> acquisitions(numBatch);
+      std::vector<char> multipleFrames(numBatch, 0);
+      // per-frame QA partials, merged in order after the batch
+      std::vector<QaAccumulator> qaPartials(m_qa ? numBatch * numChannels : 0);
+
+      threadPool().parallelFor(numBatch, [&](size_t i_batch) {
+        const GERecon::Acquisition::FrameControlPointer& frame = frames[i_batch];
+        // frames are read one at a time, only the copies run in parallel
+        std::unique_lock<std::mutex> orchestraLock(m_orchestraMutex);
+        const GERecon::Acquisition::ProgrammableControlPacket framePacket =
+          frame->Control().Packet().As<GERecon::Acquisition::ProgrammableControlPacket>();
+        int opcode = frame->Control().Opcode();
+        const MDArray::ComplexFloatCube frameRawData = frame->Data();
+        orchestraLock.unlock();
+
+        int viewValue = GERecon::Acquisition::GetPacketValue(framePacket.viewNumH, framePacket.viewNumL);
 
+        ISMRMRD::Acquisition& ismrmrd_acq = acquisitions[i_batch];
+        ismrmrd_acq.resize(lenReadout, numChannels);
+        ismrmrd_acq.idx().contrast = framePacket.echoNum;
+        ismrmrd_acq.idx().kspace_encode_step_1 = viewValue - 1;
+        setSliceCounters<Is3D>(ismrmrd_acq, GERecon::Acquisition::GetPacketValue(
+          framePacket.sliceNumH, framePacket.sliceNumL));
+        ismrmrd_acq.idx().segment = GERecon::Acquisition::GetPacketValue(
+          framePacket.echoTrainIndexH, framePacket.echoTrainIndexL);
+        ismrmrd_acq.scan_counter() = i_acquisition + i_batch;
+        ismrmrd_acq.discard_pre() = 0;
+        ismrmrd_acq.discard_post() = 0;
+        ismrmrd_acq.sample_time_us() = sample_time_us;
+        ismrmrd_acq.user_int()[0] = opcode;
+
+        multipleFrames[i_batch] = (frameRawData.extent(2) != 1);
+
+        for (int i_channel = 0; i_channel < numChannels; i_channel++) {
+          widenReadout(frameRawData.data() + i_channel * frameRawData.stride(1), frameRawData.stride(0),
+                       lenReadout, ismrmrd_acq.getDataPtr() + i_channel * lenReadout);
+          if (m_qa)
+            qaPartials[i_batch * numChannels + i_channel].add(
+              reinterpret_cast<const float*>(ismrmrd_acq.getDataPtr() + i_channel * lenReadout),
+              lenReadout, m_qa->outlierThreshold(i_channel));
+        }
+        if (m_hybridSpace && m_filterViews == 0)
+          readoutToImageSpace(ismrmrd_acq, lenReadout, numChannels);
+      }); // parallelFor (i_batch)
+
+      if (m_qa) {
+        for (size_t i_batch = 0; i_batch < numBatch; i_batch++) {
+          const ISMRMRD::EncodingCounters& idx = acquisitions[i_batch].getHead().idx;
+          size_t i_slice = Is3D ? idx.kspace_encode_step_2 : idx.slice;
+          if (i_slice >= m_qa->numSlices())
+            continue;
           for (int i_channel = 0; i_channel < numChannels; i_channel++)
-            for (int i_readout = 0; i_readout < lenReadout; i_readout++)
-              ismrmrd_acq.data(i_readout, i_channel) = frameRawData(i_readout, i_channel, 0);
+            m_qa->accumulator(i_channel, i_slice).merge(qaPartials[i_batch * numChannels + i_channel]);
+        }
+        m_qa->check();
+      }
 
-          //for (int i = 0; i < frameRawData.dimensions(); i++)
-          //  m_log << frameRawData.extent(i) << std::endl;
-          d.appendAcquisition(ismrmrd_acq);
-        } // if (viewValue...)
-      } // if (controlPacketAndFrameData->Contrl().Opcode()...)
+      for (size_t i_batch = 0; i_batch < numBatch; i_batch++) {
+        if (multipleFrames[i_batch])
+          m_log << "Warning!! Number of frames not equal to 1 for control packet" << std::endl;
+        sink.onAcquisition(acquisitions[i_batch]);
+      }
+      i_acquisition += numBatch;
+      frames.clear();
     } // for (i_control)
 
     return i_acquisition;
-  } // function GERawConverter::appendAcquisitions()
+  } // function GERawConverter::appendFramesFromArchive()
 
 } // namespace OxToIsmrmrd
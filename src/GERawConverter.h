@@ -3,6 +3,8 @@
 #define GE_RAW_CONVERTER_H
 
 #include <fstream>
+#include <memory>
+#include <mutex>
 
 // ISMRMRD
 #include "ismrmrd/ismrmrd.h"
@@ -15,6 +17,11 @@
 #include "Orchestra/Common/DownloadData.h"
 #include "Orchestra/Control/ProcessingControl.h"
 
+// Local
+#include "ConversionSink.h"
+#include "QaStatistics.h"
+#include "ThreadPool.h"
+
 namespace GeToIsmrmrd {
 
   struct logstream {
@@ -36,35 +43,77 @@ namespace GeToIsmrmrd {
   }
 
 
+  void anonymizeIsmrmrdHeader(ISMRMRD::IsmrmrdHeader& header, const std::string& anonString);
+
+
   class GERawConverter
   {
   public:
     GERawConverter(const std::string& filepath, bool logging=false);
 
+    ISMRMRD::IsmrmrdHeader getIsmrmrdHeader();
     std::string getIsmrmrdXMLHeader();
+    size_t appendNoiseInformation(ConversionSink& sink);
+    size_t appendAcquisitions(ConversionSink& sink);
     size_t appendNoiseInformation(ISMRMRD::Dataset& d);
     size_t appendAcquisitions(ISMRMRD::Dataset& d);
 
     std::string getReconConfigName(void);
     void setRDS(bool);
     void setAnonString(const std::string);
+    void setThreadPool(std::shared_ptr<ThreadPool> threadPool);
+    void setNativeSamples(bool);
+    void setHybridSpace(bool);
+    void setSparse(bool);
+    void setViewFilter(unsigned int numViews, unsigned int numSlices, unsigned int numPartitions);
+    void setQaStatistics(float outlierSigma, size_t maxOutliers);
 
   private:
     GERawConverter(const GERawConverter& other);
     GERawConverter& operator=(const GERawConverter& other);
 
     ISMRMRD::IsmrmrdHeader lxDownloadDataToIsmrmrdHeader();
-    size_t appendImagesFromPfile(ISMRMRD::Dataset& d);
-    size_t appendAcquisitionsFromPfile(ISMRMRD::Dataset& d);
-    size_t appendAcquisitionsFromArchive(ISMRMRD::Dataset& d);
+    size_t appendImagesFromPfile(ConversionSink& sink);
+    template <typename T, bool ZEncoded>
+      size_t appendKSpaceFromPfile(ConversionSink& sink);
+    template <typename T, bool ZEncoded>
+      size_t appendNativeImagesFromPfile(ConversionSink& sink);
+    template <typename T, bool ZEncoded>
+      size_t appendHybridFromPfile(ConversionSink& sink);
+    template <typename T, bool ZEncoded, bool Is3D>
+      size_t appendSparseFromPfile(ConversionSink& sink);
+    int storedSampleSize();
+    double storedSampleScale();
+    template <typename T, bool ZEncoded>
+      double measureSampleScale();
+    std::string nativeSampleType();
+    size_t appendAcquisitionsFromPfile(ConversionSink& sink);
+    size_t appendAcquisitionsFromArchive(ConversionSink& sink);
+    template <bool Is3D>
+      size_t appendFramesFromArchive(ConversionSink& sink);
+    ThreadPool& threadPool();
+    void startQa(size_t numSlices, double sampleScale = 1.0);
 
     bool m_isScanArchive;
     bool m_isRDS;
+    bool m_nativeSamples;
+    bool m_hybridSpace;
+    bool m_sparse;
+    unsigned int m_filterViews;
+    unsigned int m_filterSlices;
+    unsigned int m_filterPartitions;
+    float m_qaSigma;
+    size_t m_qaMaxOutliers;
+    double m_storedSampleScale;
+    std::shared_ptr<QaStatistics> m_qa;
     std::string m_anonString;
     GERecon::Legacy::PfilePointer m_pfile;
     GERecon::ScanArchivePointer m_scanArchive;
     GERecon::DownloadDataPointer m_downloadDataPtr;
     GERecon::Control::ProcessingControlPointer m_processingControl;
+    std::shared_ptr<ThreadPool> m_threadPool;
+    /** Serializes Pfile and frame reads from the thread pool */
+    std::mutex m_orchestraMutex;
 
     logstream m_log;
   };
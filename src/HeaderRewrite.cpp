@@ -0,0 +1,54 @@
+
+/** @file HeaderRewrite.cpp */
+#include <sstream>
+#include <stdexcept>
+
+// ISMRMRD
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/xml.h"
+
+// Local
+#include "GERawConverter.h"
+#include "HeaderRewrite.h"
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Replaces the XML header of an existing ISMRMRD file. Only the "xml"
+   * dataset is rewritten; acquisitions, images and arrays are not touched.
+   *
+   * @param datasetPath ISMRMRD file written by the converter
+   * @param anonString anonymize the header with this string (empty = keep as is)
+   * @param xmlHeader new header, e.g. regenerated from the raw file; empty
+   *                  to patch the header already in the file
+   * @throws std::runtime_error if the file has no header or nothing would change
+   */
+  void rewriteHeader(const std::string& datasetPath, const std::string& anonString,
+                     const std::string& xmlHeader)
+  {
+    if (xmlHeader.empty() && anonString.empty())
+      throw std::runtime_error("Nothing to rewrite: give an anon string or a raw input file");
+
+    ISMRMRD::Dataset d(datasetPath.c_str(), "dataset", false);
+
+    std::string xml = xmlHeader;
+    if (xml.empty()) {
+      d.readHeader(xml);
+      if (xml.empty())
+        throw std::runtime_error("No ISMRMRD header in " + datasetPath);
+    }
+
+    if (!anonString.empty()) {
+      ISMRMRD::IsmrmrdHeader header;
+      ISMRMRD::deserialize(xml.c_str(), header);
+      anonymizeIsmrmrdHeader(header, anonString);
+
+      std::stringstream str;
+      ISMRMRD::serialize(header, str);
+      xml = str.str();
+    }
+
+    d.writeHeader(xml);
+  }
+
+} // namespace GeToIsmrmrd
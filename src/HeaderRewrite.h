@@ -0,0 +1,14 @@
+/** @file HeaderRewrite.h */
+#ifndef HEADER_REWRITE_H
+#define HEADER_REWRITE_H
+
+#include <string>
+
+namespace GeToIsmrmrd {
+
+  void rewriteHeader(const std::string& datasetPath, const std::string& anonString,
+                     const std::string& xmlHeader = "");
+
+} // namespace GeToIsmrmrd
+
+#endif  // HEADER_REWRITE_H
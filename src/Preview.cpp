@@ -0,0 +1,387 @@
+
+/** @file Preview.cpp */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+
+// ISMRMRD
+#include "ismrmrd/dataset.h"
+#include "ismrmrd/xml.h"
+
+// Local
+#include "Fft.h"
+#include "Preview.h"
+
+namespace GeToIsmrmrd {
+
+  namespace {
+
+    bool endsWith(const std::string& str, const std::string& suffix)
+    {
+      return str.size() >= suffix.size()
+        && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    std::vector<uint32_t> crc32Table()
+    {
+      std::vector<uint32_t> table(256);
+      for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++)
+          c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        table[n] = c;
+      }
+      return table;
+    }
+
+    uint32_t crc32(const std::vector<uint8_t>& bytes, size_t offset)
+    {
+      // initialized once, thread-safely, by the first PNG written
+      static const std::vector<uint32_t> table = crc32Table();
+
+      uint32_t crc = 0xffffffffu;
+      for (size_t i = offset; i < bytes.size(); i++)
+        crc = table[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+      return crc ^ 0xffffffffu;
+    }
+
+    void appendUint32(std::vector<uint8_t>& bytes, uint32_t value)
+    {
+      bytes.push_back((value >> 24) & 0xff);
+      bytes.push_back((value >> 16) & 0xff);
+      bytes.push_back((value >> 8) & 0xff);
+      bytes.push_back(value & 0xff);
+    }
+
+    void writeChunk(std::ofstream& out, const char* type, const std::vector<uint8_t>& data)
+    {
+      std::vector<uint8_t> chunk(type, type + 4);
+      chunk.insert(chunk.end(), data.begin(), data.end());
+
+      std::vector<uint8_t> length;
+      appendUint32(length, (uint32_t) data.size());
+      std::vector<uint8_t> crc;
+      appendUint32(crc, crc32(chunk, 0));
+
+      out.write((const char*) &length[0], length.size());
+      out.write((const char*) &chunk[0], chunk.size());
+      out.write((const char*) &crc[0], crc.size());
+    }
+
+    /**
+     * Wraps bytes in a zlib stream of uncompressed deflate blocks, which
+     * is all a thumbnail needs and avoids a zlib dependency
+     */
+    std::vector<uint8_t> zlibStore(const std::vector<uint8_t>& raw)
+    {
+      std::vector<uint8_t> out;
+      out.push_back(0x78);
+      out.push_back(0x01);
+
+      size_t pos = 0;
+      do {
+        size_t len = std::min<size_t>(65535, raw.size() - pos);
+        bool last = (pos + len == raw.size());
+        out.push_back(last ? 1 : 0);
+        out.push_back(len & 0xff);
+        out.push_back((len >> 8) & 0xff);
+        out.push_back(~len & 0xff);
+        out.push_back((~len >> 8) & 0xff);
+        out.insert(out.end(), raw.begin() + pos, raw.begin() + pos + len);
+        pos += len;
+      } while (pos < raw.size());
+
+      uint32_t a = 1, b = 0;
+      for (size_t i = 0; i < raw.size(); i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+      }
+      appendUint32(out, (b << 16) | a);
+      return out;
+    }
+
+  } // namespace
+
+
+  /**
+   * Computes the central window of keep elements out of total, centred on
+   * total / 2 like the ISMRMRD encoding limits
+   */
+  void centralRange(size_t total, size_t keep, size_t& first, size_t& count)
+  {
+    count = std::min(total, keep);
+    size_t centre = total / 2;
+    first = (centre > count / 2) ? centre - count / 2 : 0;
+    if (first + count > total)
+      first = total - count;
+  }
+
+
+  /**
+   * @param outputPath PNG (.png) or ISMRMRD (.h5) file to write
+   * @throws std::runtime_error for any other extension
+   */
+  PreviewSink::PreviewSink(const std::string& outputPath)
+    : m_outputPath(outputPath),
+      m_is3D(false),
+      m_lenReadout(0),
+      m_numViews(0),
+      m_numSlices(0),
+      m_numChannels(0),
+      m_firstView(0),
+      m_numPreviewViews(0),
+      m_firstSlice(0),
+      m_numPreviewSlices(0)
+  {
+    if (!endsWith(m_outputPath, ".png") && !endsWith(m_outputPath, ".h5"))
+      throw std::runtime_error("Preview file must end in .png or .h5: " + m_outputPath);
+  }
+
+
+  void PreviewSink::onHeader(const std::string& xmlHeader)
+  {
+    m_xmlHeader = xmlHeader;
+
+    ISMRMRD::IsmrmrdHeader header;
+    ISMRMRD::deserialize(xmlHeader.c_str(), header);
+    const ISMRMRD::Encoding& encoding = header.encoding.at(0);
+
+    m_lenReadout = encoding.encodedSpace.matrixSize.x;
+    m_numViews = encoding.encodedSpace.matrixSize.y;
+    m_is3D = encoding.encodingLimits.kspace_encoding_step_2.is_present()
+      && encoding.encodingLimits.kspace_encoding_step_2.get().maximum > 0;
+    m_numSlices = m_is3D ? encoding.encodedSpace.matrixSize.z
+      : encoding.encodingLimits.slice.get().maximum + 1;
+    m_numChannels = header.acquisitionSystemInformation.get().receiverChannels.get();
+
+    centralRange(m_numViews, PREVIEW_VIEWS, m_firstView, m_numPreviewViews);
+    centralRange(m_numSlices, m_is3D ? PREVIEW_PARTITIONS : PREVIEW_SLICES,
+                 m_firstSlice, m_numPreviewSlices);
+
+    m_kspace.assign(m_lenReadout * m_numPreviewViews * m_numPreviewSlices * m_numChannels,
+                    std::complex<float>(0, 0));
+  }
+
+
+  void PreviewSink::onNoise(const std::string&, const ISMRMRD::NDArray<float>&)
+  {
+  }
+
+
+  /**
+   * Places a readout that falls inside the preview window (first contrast only)
+   */
+  void PreviewSink::onAcquisition(const ISMRMRD::Acquisition& acq)
+  {
+    const ISMRMRD::AcquisitionHeader& head = acq.getHead();
+    if (head.idx.contrast != 0)
+      return;
+
+    size_t i_view = head.idx.kspace_encode_step_1;
+    size_t i_slice = m_is3D ? head.idx.kspace_encode_step_2 : head.idx.slice;
+    if (i_view < m_firstView || i_view >= m_firstView + m_numPreviewViews
+        || i_slice < m_firstSlice || i_slice >= m_firstSlice + m_numPreviewSlices)
+      return;
+
+    size_t numSamples = std::min<size_t>(head.number_of_samples, m_lenReadout);
+    size_t numChannels = std::min<size_t>(head.active_channels, m_numChannels);
+    const std::complex<float>* data = acq.getDataPtr();
+    for (size_t i_channel = 0; i_channel < numChannels; i_channel++)
+      for (size_t i_readout = 0; i_readout < numSamples; i_readout++)
+        sample(i_readout, i_view - m_firstView, i_slice - m_firstSlice, i_channel) =
+          data[i_channel * head.number_of_samples + i_readout];
+  }
+
+
+  /**
+   * Takes a k-space volume that holds only the preview window, or crops the
+   * window from a full volume (when the preview is one of several outputs)
+   */
+  void PreviewSink::onImage(const std::string&, const ISMRMRD::Image<std::complex<float> >& image)
+  {
+    if (image.getContrast() != 0 || image.getPhase() != 0)
+      return;
+
+    if (image.getMatrixSizeX() != m_lenReadout || image.getNumberOfChannels() != m_numChannels)
+      throw std::runtime_error("Preview received k-space of unexpected size");
+
+    if (image.getMatrixSizeY() == m_numPreviewViews && image.getMatrixSizeZ() == m_numPreviewSlices) {
+      std::copy(image.getDataPtr(), image.getDataPtr() + m_kspace.size(), m_kspace.begin());
+      return;
+    }
+
+    if (image.getMatrixSizeY() != m_numViews || image.getMatrixSizeZ() != m_numSlices)
+      throw std::runtime_error("Preview received k-space outside the preview window");
+
+    const std::complex<float>* data = image.getDataPtr();
+    for (size_t i_channel = 0; i_channel < m_numChannels; i_channel++)
+      for (size_t i_slice = 0; i_slice < m_numPreviewSlices; i_slice++)
+        for (size_t i_view = 0; i_view < m_numPreviewViews; i_view++) {
+          const std::complex<float>* readout = data
+            + ((i_channel * m_numSlices + m_firstSlice + i_slice) * m_numViews + m_firstView + i_view) * m_lenReadout;
+          std::copy(readout, readout + m_lenReadout, &sample(0, i_view, i_slice, i_channel));
+        }
+  }
+
+
+  void PreviewSink::onImage(const std::string&, const ISMRMRD::Image<short>&)
+  {
+    throw std::runtime_error("Preview needs complex float k-space");
+  }
+
+
+  void PreviewSink::onImage(const std::string&, const ISMRMRD::Image<int>&)
+  {
+    throw std::runtime_error("Preview needs complex float k-space");
+  }
+
+
+  void PreviewSink::onArray(const std::string&, const ISMRMRD::NDArray<std::complex<float> >&)
+  {
+    throw std::runtime_error("Preview needs k-space, not hybrid-space data");
+  }
+
+
+  void PreviewSink::onComplete()
+  {
+    size_t width = 0, height = 0;
+    std::vector<std::vector<float> > slices = reconstruct(width, height);
+
+    if (endsWith(m_outputPath, ".png"))
+      writePng(slices, width, height);
+    else
+      writeDataset(slices, width, height);
+  }
+
+
+  std::complex<float>& PreviewSink::sample(size_t i_readout, size_t i_view, size_t i_slice, size_t i_channel)
+  {
+    return m_kspace[((i_channel * m_numPreviewSlices + i_slice) * m_numPreviewViews + i_view) * m_lenReadout
+                    + i_readout];
+  }
+
+
+  /**
+   * Fourier transforms the preview window and combines the coils. The
+   * readout is cropped by the same factor as the views so the thumbnail
+   * keeps its aspect ratio. For 3D data the partitions are transformed
+   * first and the middle PREVIEW_SLICES positions are kept.
+   */
+  std::vector<std::vector<float> > PreviewSink::reconstruct(size_t& width, size_t& height)
+  {
+    if (m_kspace.empty())
+      throw std::runtime_error("Preview has no data");
+
+    if (m_is3D && m_numPreviewSlices > 1) {
+      FftPlan plan(m_numPreviewSlices);
+      std::vector<std::complex<float> > line(m_numPreviewSlices);
+      for (size_t i_channel = 0; i_channel < m_numChannels; i_channel++)
+        for (size_t i_view = 0; i_view < m_numPreviewViews; i_view++)
+          for (size_t i_readout = 0; i_readout < m_lenReadout; i_readout++) {
+            for (size_t i_slice = 0; i_slice < m_numPreviewSlices; i_slice++)
+              line[i_slice] = sample(i_readout, i_view, i_slice, i_channel);
+            plan.inverseCentered(&line[0]);
+            for (size_t i_slice = 0; i_slice < m_numPreviewSlices; i_slice++)
+              sample(i_readout, i_view, i_slice, i_channel) = line[i_slice];
+          }
+    }
+
+    size_t firstSlice = 0, numSlices = m_numPreviewSlices;
+    if (m_is3D)
+      centralRange(m_numPreviewSlices, PREVIEW_SLICES, firstSlice, numSlices);
+
+    size_t keepReadout = std::max<size_t>(1, (m_lenReadout * m_numPreviewViews + m_numViews / 2) / m_numViews);
+    size_t firstReadout = 0;
+    centralRange(m_lenReadout, keepReadout, firstReadout, width);
+    height = m_numPreviewViews;
+
+    FftPlan readoutPlan(width);
+    FftPlan viewPlan(height);
+    std::vector<std::complex<float> > image(width * height);
+    std::vector<std::complex<float> > column(height);
+    std::vector<std::vector<float> > slices(numSlices, std::vector<float>(width * height, 0.0f));
+
+    for (size_t i_out = 0; i_out < numSlices; i_out++) {
+      std::vector<float>& rss = slices[i_out];
+      for (size_t i_channel = 0; i_channel < m_numChannels; i_channel++) {
+        for (size_t y = 0; y < height; y++) {
+          for (size_t x = 0; x < width; x++)
+            image[y * width + x] = sample(firstReadout + x, y, firstSlice + i_out, i_channel);
+          readoutPlan.inverseCentered(&image[y * width]);
+        }
+        for (size_t x = 0; x < width; x++) {
+          for (size_t y = 0; y < height; y++)
+            column[y] = image[y * width + x];
+          viewPlan.inverseCentered(&column[0]);
+          for (size_t y = 0; y < height; y++)
+            rss[y * width + x] += std::norm(column[y]);
+        }
+      }
+      for (size_t i = 0; i < rss.size(); i++)
+        rss[i] = std::sqrt(rss[i]);
+    }
+
+    return slices;
+  }
+
+
+  /**
+   * Writes the slices side by side as an 8-bit greyscale PNG
+   */
+  void PreviewSink::writePng(const std::vector<std::vector<float> >& slices, size_t width, size_t height)
+  {
+    float maxValue = 0.0f;
+    for (size_t i = 0; i < slices.size(); i++)
+      maxValue = std::max(maxValue, *std::max_element(slices[i].begin(), slices[i].end()));
+    float scale = maxValue > 0.0f ? 255.0f / maxValue : 0.0f;
+
+    size_t mosaicWidth = width * slices.size();
+    std::vector<uint8_t> raw;
+    raw.reserve((mosaicWidth + 1) * height);
+    for (size_t y = 0; y < height; y++) {
+      raw.push_back(0); // no filter
+      for (size_t i_slice = 0; i_slice < slices.size(); i_slice++)
+        for (size_t x = 0; x < width; x++)
+          raw.push_back((uint8_t) (slices[i_slice][y * width + x] * scale + 0.5f));
+    }
+
+    std::vector<uint8_t> ihdr;
+    appendUint32(ihdr, (uint32_t) mosaicWidth);
+    appendUint32(ihdr, (uint32_t) height);
+    ihdr.push_back(8); // bit depth
+    ihdr.push_back(0); // greyscale
+    ihdr.push_back(0); // deflate
+    ihdr.push_back(0); // adaptive filtering
+    ihdr.push_back(0); // no interlace
+
+    std::ofstream out(m_outputPath.c_str(), std::ios::binary);
+    if (!out)
+      throw std::runtime_error("Failed to open " + m_outputPath);
+    const char signature[] = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+    out.write(signature, sizeof(signature));
+    writeChunk(out, "IHDR", ihdr);
+    writeChunk(out, "IDAT", zlibStore(raw));
+    writeChunk(out, "IEND", std::vector<uint8_t>());
+  }
+
+
+  /**
+   * Writes the slices as magnitude images next to the ISMRMRD header
+   */
+  void PreviewSink::writeDataset(const std::vector<std::vector<float> >& slices, size_t width, size_t height)
+  {
+    ISMRMRD::Dataset d(m_outputPath.c_str(), "dataset", true);
+    d.writeHeader(m_xmlHeader);
+
+    for (size_t i_slice = 0; i_slice < slices.size(); i_slice++) {
+      ISMRMRD::Image<float> image(width, height, 1, 1);
+      image.setImageType(ISMRMRD::ISMRMRD_ImageTypes::ISMRMRD_IMTYPE_MAGNITUDE);
+      image.setSlice(i_slice);
+      std::copy(slices[i_slice].begin(), slices[i_slice].end(), image.getDataPtr());
+      d.appendImage("preview", image);
+    }
+  }
+
+} // namespace GeToIsmrmrd
@@ -0,0 +1,69 @@
+/** @file Preview.h */
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <complex>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Local
+#include "ConversionSink.h"
+
+namespace GeToIsmrmrd {
+
+  // Central k-space kept for a preview
+  static const unsigned int PREVIEW_VIEWS = 64;
+  static const unsigned int PREVIEW_SLICES = 3;
+  static const unsigned int PREVIEW_PARTITIONS = 16;
+
+  void centralRange(size_t total, size_t keep, size_t& first, size_t& count);
+
+
+  /**
+   * Builds low-resolution magnitude thumbnails from the central k-space
+   * handed over by a converter whose view filter is set to the PREVIEW_*
+   * sizes. On completion the data is Fourier transformed, the coils are
+   * combined by root-sum-of-squares and the middle slices are written side
+   * by side to a PNG file, or as float images to an ISMRMRD file (.h5).
+   */
+  class PreviewSink : public ConversionSink
+  {
+  public:
+    PreviewSink(const std::string& outputPath);
+
+    void onHeader(const std::string& xmlHeader);
+    void onNoise(const std::string& name, const ISMRMRD::NDArray<float>& values);
+    void onAcquisition(const ISMRMRD::Acquisition& acq);
+    void onImage(const std::string& name, const ISMRMRD::Image<std::complex<float> >& image);
+    void onImage(const std::string& name, const ISMRMRD::Image<short>& image);
+    void onImage(const std::string& name, const ISMRMRD::Image<int>& image);
+    void onArray(const std::string& name, const ISMRMRD::NDArray<std::complex<float> >& array);
+    void onComplete();
+
+  private:
+    PreviewSink(const PreviewSink& other);
+    PreviewSink& operator=(const PreviewSink& other);
+
+    std::complex<float>& sample(size_t i_readout, size_t i_view, size_t i_slice, size_t i_channel);
+    std::vector<std::vector<float> > reconstruct(size_t& width, size_t& height);
+    void writePng(const std::vector<std::vector<float> >& slices, size_t width, size_t height);
+    void writeDataset(const std::vector<std::vector<float> >& slices, size_t width, size_t height);
+
+    std::string m_outputPath;
+    std::string m_xmlHeader;
+    bool m_is3D;
+    size_t m_lenReadout;
+    size_t m_numViews;
+    size_t m_numSlices;
+    size_t m_numChannels;
+    size_t m_firstView;
+    size_t m_numPreviewViews;
+    size_t m_firstSlice;
+    size_t m_numPreviewSlices;
+    std::vector<std::complex<float> > m_kspace;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // PREVIEW_H
@@ -0,0 +1,195 @@
+
+/** @file QaStatistics.cpp */
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+// Local
+#include "QaStatistics.h"
+
+namespace GeToIsmrmrd {
+
+  namespace {
+
+    // Independent partial results per lane let the compiler vectorize the
+    // reductions without reassociating floating point math
+    const size_t QA_LANES = 8;
+
+    // Samples summed in float before the block result is added in double
+    const size_t QA_BLOCK = 4096;
+
+  } // namespace
+
+
+  QaAccumulator::QaAccumulator()
+    : sum(0),
+      sumSquares(0),
+      maxSquaredMagnitude(0),
+      numValues(0),
+      numOutliers(0)
+  {
+  }
+
+
+  /**
+   * Adds interleaved (real, imaginary) samples
+   *
+   * @param values 2 * numSamples values
+   * @param outlierSquaredMagnitude squared magnitude above which a sample is an outlier
+   */
+  template <typename T>
+    void QaAccumulator::add(const T* values, size_t numSamples, float outlierSquaredMagnitude)
+  {
+    for (size_t first = 0; first < numSamples; first += QA_BLOCK) {
+      const size_t numBlock = std::min(QA_BLOCK, numSamples - first);
+      const T* block = values + 2 * first;
+
+      float laneSum[QA_LANES] = {0};
+      float laneSquares[QA_LANES] = {0};
+      float laneMax[QA_LANES] = {0};
+      unsigned int laneOutliers[QA_LANES] = {0};
+
+      size_t i = 0;
+      for (; i + QA_LANES <= numBlock; i += QA_LANES) {
+        for (size_t lane = 0; lane < QA_LANES; lane++) {
+          float re = (float) block[2 * (i + lane)];
+          float im = (float) block[2 * (i + lane) + 1];
+          float squaredMagnitude = re * re + im * im;
+          laneSum[lane] += re + im;
+          laneSquares[lane] += squaredMagnitude;
+          laneMax[lane] = squaredMagnitude > laneMax[lane] ? squaredMagnitude : laneMax[lane];
+          laneOutliers[lane] += squaredMagnitude > outlierSquaredMagnitude;
+        }
+      }
+      for (; i < numBlock; i++) {
+        float re = (float) block[2 * i];
+        float im = (float) block[2 * i + 1];
+        float squaredMagnitude = re * re + im * im;
+        laneSum[0] += re + im;
+        laneSquares[0] += squaredMagnitude;
+        laneMax[0] = std::max(laneMax[0], squaredMagnitude);
+        laneOutliers[0] += squaredMagnitude > outlierSquaredMagnitude;
+      }
+
+      for (size_t lane = 0; lane < QA_LANES; lane++) {
+        sum += laneSum[lane];
+        sumSquares += laneSquares[lane];
+        maxSquaredMagnitude = std::max(maxSquaredMagnitude, laneMax[lane]);
+        numOutliers += laneOutliers[lane];
+      }
+      numValues += 2 * numBlock;
+    }
+  }
+
+  template void QaAccumulator::add<float>(const float*, size_t, float);
+  template void QaAccumulator::add<short>(const short*, size_t, float);
+  template void QaAccumulator::add<int>(const int*, size_t, float);
+
+
+  void QaAccumulator::merge(const QaAccumulator& other)
+  {
+    sum += other.sum;
+    sumSquares += other.sumSquares;
+    maxSquaredMagnitude = std::max(maxSquaredMagnitude, other.maxSquaredMagnitude);
+    numValues += other.numValues;
+    numOutliers += other.numOutliers;
+  }
+
+
+  /**
+   * @param recStd receiver noise standard deviation per channel
+   * @param outlierSigma outlier threshold in multiples of rec_std
+   * @param maxOutliers outliers allowed per channel and slice before check() fails
+   *                    (std::numeric_limits<size_t>::max() for no limit)
+   * @param sampleScale float k-space value of one unit of the accumulated
+   *                    samples, e.g. KSpaceSampleScale for stored integers
+   */
+  QaStatistics::QaStatistics(const std::vector<float>& recStd, size_t numSlices,
+                             float outlierSigma, size_t maxOutliers, double sampleScale)
+    : m_outlierThresholds(recStd.size()),
+      m_numSlices(std::max<size_t>(numSlices, 1)),
+      m_maxOutliers(maxOutliers),
+      m_sampleScale(sampleScale),
+      m_accumulators(recStd.size() * std::max<size_t>(numSlices, 1))
+  {
+    for (size_t i_channel = 0; i_channel < recStd.size(); i_channel++) {
+      // without a noise estimate nothing counts as an outlier; rec_std is
+      // in float k-space units, the accumulated samples in stored units
+      float threshold = (float) (outlierSigma * recStd[i_channel] / sampleScale);
+      m_outlierThresholds[i_channel] = threshold > 0 ? threshold * threshold
+        : std::numeric_limits<float>::infinity();
+    }
+  }
+
+
+  size_t QaStatistics::numChannels() const
+  {
+    return m_outlierThresholds.size();
+  }
+
+
+  size_t QaStatistics::numSlices() const
+  {
+    return m_numSlices;
+  }
+
+
+  /**
+   * Squared magnitude above which a sample of the channel is an outlier
+   */
+  float QaStatistics::outlierThreshold(size_t i_channel) const
+  {
+    return m_outlierThresholds[i_channel];
+  }
+
+
+  QaAccumulator& QaStatistics::accumulator(size_t i_channel, size_t i_slice)
+  {
+    return m_accumulators[i_channel * m_numSlices + i_slice];
+  }
+
+
+  /**
+   * @throws std::runtime_error if a channel and slice has more outliers than allowed
+   */
+  void QaStatistics::check() const
+  {
+    for (size_t i = 0; i < m_accumulators.size(); i++) {
+      if (m_accumulators[i].numOutliers > m_maxOutliers) {
+        std::stringstream str;
+        str << "QA failed: channel " << i / m_numSlices << ", slice " << i % m_numSlices
+            << " has " << m_accumulators[i].numOutliers << " outlier samples (limit "
+            << m_maxOutliers << ")";
+        throw std::runtime_error(str.str());
+      }
+    }
+  }
+
+
+  void QaStatistics::append(ConversionSink& sink) const
+  {
+    std::vector<size_t> dims = {m_numSlices, numChannels()};
+    ISMRMRD::NDArray<float> mean(dims);
+    ISMRMRD::NDArray<float> variance(dims);
+    ISMRMRD::NDArray<float> maxMagnitude(dims);
+    ISMRMRD::NDArray<float> outliers(dims);
+
+    for (size_t i = 0; i < m_accumulators.size(); i++) {
+      const QaAccumulator& acc = m_accumulators[i];
+      double n = acc.numValues > 0 ? (double) acc.numValues : 1.0;
+      double m = acc.sum / n;
+      mean.getDataPtr()[i] = (float) (m_sampleScale * m);
+      variance.getDataPtr()[i] = (float) (m_sampleScale * m_sampleScale * std::max(0.0, acc.sumSquares / n - m * m));
+      maxMagnitude.getDataPtr()[i] = (float) (m_sampleScale * std::sqrt(acc.maxSquaredMagnitude));
+      outliers.getDataPtr()[i] = (float) acc.numOutliers;
+    }
+
+    sink.onNoise("qa_mean", mean);
+    sink.onNoise("qa_variance", variance);
+    sink.onNoise("qa_max", maxMagnitude);
+    sink.onNoise("qa_outliers", outliers);
+  }
+
+} // namespace GeToIsmrmrd
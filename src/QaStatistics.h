@@ -0,0 +1,73 @@
+/** @file QaStatistics.h */
+#ifndef QA_STATISTICS_H
+#define QA_STATISTICS_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Local
+#include "ConversionSink.h"
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Running statistics of the complex samples of one channel and slice.
+   * Real and imaginary parts are pooled, so mean and variance compare
+   * directly with the receiver's rec_mean and rec_std.
+   */
+  struct QaAccumulator
+  {
+    QaAccumulator();
+
+    template <typename T>
+      void add(const T* values, size_t numSamples, float outlierSquaredMagnitude);
+    void merge(const QaAccumulator& other);
+
+    double sum;
+    double sumSquares;
+    float maxSquaredMagnitude;
+    size_t numValues;
+    size_t numOutliers;
+  };
+
+
+  /**
+   * Per-channel, per-slice QA statistics gathered while the data is copied.
+   *
+   * A sample is an outlier when its magnitude exceeds outlierSigma times the
+   * channel's rec_std. k-space centre samples exceed that legitimately, so
+   * the counts are meant to be compared between channels and slices: RF
+   * spikes show up as a channel or slice with many more outliers and a much
+   * higher maximum, dead elements as a variance near the noise level.
+   *
+   * The results are written as float arrays qa_mean, qa_variance, qa_max
+   * and qa_outliers of dimensions (slices, channels), slices varying
+   * fastest, next to rec_std and rec_mean. Samples accumulated as stored
+   * integers are reported in float k-space units through sampleScale.
+   */
+  class QaStatistics
+  {
+  public:
+    QaStatistics(const std::vector<float>& recStd, size_t numSlices,
+                 float outlierSigma, size_t maxOutliers, double sampleScale = 1.0);
+
+    size_t numChannels() const;
+    size_t numSlices() const;
+    float outlierThreshold(size_t i_channel) const;
+    QaAccumulator& accumulator(size_t i_channel, size_t i_slice);
+
+    void check() const;
+    void append(ConversionSink& sink) const;
+
+  private:
+    std::vector<float> m_outlierThresholds;
+    size_t m_numSlices;
+    size_t m_maxOutliers;
+    double m_sampleScale;
+    std::vector<QaAccumulator> m_accumulators;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // QA_STATISTICS_H
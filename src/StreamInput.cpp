@@ -0,0 +1,181 @@
+
+/** @file StreamInput.cpp */
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Local
+#include "StreamInput.h"
+
+namespace GeToIsmrmrd {
+
+  // Bytes read from the stream per copy
+  static const size_t STREAM_BUFFER_SIZE = 4 * 1024 * 1024;
+
+  namespace {
+
+    /**
+     * Anonymous in-memory file; falls back to an unlinked file on tmpfs when
+     * the kernel or libc has no memfd_create
+     */
+    int createMemoryFile()
+    {
+      int fd = -1;
+#ifdef SYS_memfd_create
+      fd = (int) syscall(SYS_memfd_create, "ge_to_ismrmrd", 0);
+      if (fd >= 0)
+        return fd;
+#endif
+      char name[] = "/dev/shm/ge_to_ismrmrd.XXXXXX";
+      fd = mkstemp(name);
+      if (fd >= 0)
+        unlink(name);
+      return fd;
+    }
+
+  } // namespace
+
+
+  /**
+   * Copies the whole stream into memory
+   *
+   * @param inputPath "-" for stdin, or the path of a FIFO
+   * @throws std::runtime_error if the stream or the in-memory file cannot be
+   *         opened, or the stream fails or is empty
+   */
+  StreamInput::StreamInput(const std::string& inputPath, bool logging)
+    : m_inputFd(-1),
+      m_memoryFd(-1),
+      m_log(logging)
+  {
+    if (inputPath == "-")
+      m_inputFd = STDIN_FILENO;
+    else if ((m_inputFd = open(inputPath.c_str(), O_RDONLY)) < 0)
+      throw std::runtime_error("Failed to open " + inputPath);
+
+    if ((m_memoryFd = createMemoryFile()) < 0) {
+      if (m_inputFd != STDIN_FILENO)
+        close(m_inputFd);
+      throw std::runtime_error("Failed to create in-memory file for " + inputPath);
+    }
+
+    try {
+      m_log << "Streaming input from " << (inputPath == "-" ? "stdin" : inputPath) << "..." << std::endl;
+      size_t numBytes = copy();
+      if (numBytes == 0)
+        throw std::runtime_error("Input stream is empty");
+      m_log << "Received " << numBytes << " bytes" << std::endl;
+      createPath();
+    } catch (...) {
+      cleanup();
+      throw;
+    }
+  }
+
+
+  StreamInput::~StreamInput()
+  {
+    cleanup();
+  }
+
+
+  void StreamInput::cleanup()
+  {
+    if (!m_path.empty())
+      unlink(m_path.c_str());
+    if (!m_linkDirectory.empty())
+      rmdir(m_linkDirectory.c_str());
+    close(m_memoryFd);
+    if (m_inputFd != STDIN_FILENO)
+      close(m_inputFd);
+  }
+
+
+  /**
+   * True for "-" (stdin) and for FIFOs, sockets and character devices
+   */
+  bool StreamInput::isStream(const std::string& inputPath)
+  {
+    if (inputPath == "-")
+      return true;
+
+    struct stat info;
+    if (stat(inputPath.c_str(), &info) != 0)
+      return false;
+    return S_ISFIFO(info.st_mode) || S_ISSOCK(info.st_mode) || S_ISCHR(info.st_mode);
+  }
+
+
+  /**
+   * Path under which the in-memory copy can be opened
+   */
+  const std::string& StreamInput::path() const
+  {
+    return m_path;
+  }
+
+
+  /**
+   * Links the in-memory file under the name Orchestra expects for its
+   * format
+   */
+  void StreamInput::createPath()
+  {
+    char signature[8] = {0};
+    const char hdf5Signature[8] = {'\x89', 'H', 'D', 'F', '\r', '\n', '\x1a', '\n'};
+    bool isArchive = pread(m_memoryFd, signature, sizeof(signature), 0) == (ssize_t) sizeof(signature)
+      && std::memcmp(signature, hdf5Signature, sizeof(signature)) == 0;
+
+    char directory[] = "/tmp/ge_to_ismrmrd.XXXXXX";
+    if (!mkdtemp(directory))
+      throw std::runtime_error("Failed to create a directory for the streamed input");
+    m_linkDirectory = directory;
+
+    std::string linkPath = m_linkDirectory + (isArchive ? "/ScanArchive_stream.h5" : "/P00000.7");
+    std::string target = "/proc/self/fd/" + std::to_string(m_memoryFd);
+    if (symlink(target.c_str(), linkPath.c_str()) != 0)
+      throw std::runtime_error("Failed to create " + linkPath);
+    m_path = linkPath;
+  }
+
+
+  /**
+   * Copies the stream into the in-memory file until it ends
+   *
+   * @returns number of bytes received
+   * @throws std::runtime_error if reading or writing fails
+   */
+  size_t StreamInput::copy()
+  {
+    std::vector<char> buffer(STREAM_BUFFER_SIZE);
+    off_t offset = 0;
+
+    for (;;) {
+      ssize_t numRead = read(m_inputFd, &buffer[0], buffer.size());
+      if (numRead < 0 && errno == EINTR)
+        continue;
+      if (numRead < 0)
+        throw std::runtime_error(std::strerror(errno));
+      if (numRead == 0)
+        return offset;
+
+      for (ssize_t written = 0; written < numRead; ) {
+        ssize_t n = pwrite(m_memoryFd, &buffer[written], numRead - written, offset + written);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0)
+          throw std::runtime_error(std::string("Failed to buffer input stream: ") + std::strerror(errno));
+        written += n;
+      }
+      offset += numRead;
+    }
+  }
+
+} // namespace GeToIsmrmrd
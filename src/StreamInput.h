@@ -0,0 +1,50 @@
+/** @file StreamInput.h */
+#ifndef STREAM_INPUT_H
+#define STREAM_INPUT_H
+
+#include <string>
+
+// Local
+#include "GERawConverter.h"
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Raw input read from stdin ("-") or a FIFO.
+   *
+   * Orchestra only opens files by path, so the whole stream is copied into
+   * an anonymous in-memory file when constructed and exposed under a path
+   * with the extension Orchestra expects. Conversion cannot start earlier:
+   * Orchestra counts P-file acquisitions from the file length, and
+   * ScanArchives are HDF5 files. The in-memory copy takes as much RAM (or
+   * /dev/shm space) as the raw file.
+   */
+  class StreamInput
+  {
+  public:
+    StreamInput(const std::string& inputPath, bool logging=false);
+    ~StreamInput();
+
+    static bool isStream(const std::string& inputPath);
+
+    const std::string& path() const;
+
+  private:
+    StreamInput(const StreamInput& other);
+    StreamInput& operator=(const StreamInput& other);
+
+    size_t copy();
+    void createPath();
+    void cleanup();
+
+    int m_inputFd;
+    int m_memoryFd;
+    std::string m_linkDirectory;
+    std::string m_path;
+
+    logstream m_log;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // STREAM_INPUT_H
@@ -0,0 +1,224 @@
+
+/** @file ThreadPool.cpp */
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Local
+#include "ThreadPool.h"
+
+namespace GeToIsmrmrd {
+
+  namespace {
+
+    /**
+     * Shared bookkeeping for one parallelFor() call. Helpers hold it by
+     * shared_ptr, so a helper that is dequeued after the loop has finished
+     * finds no work left and exits without touching the caller's stack.
+     */
+    struct LoopState {
+      LoopState(size_t n, const std::function<void(size_t)>& f)
+        : count(n), body(f), next(0), failed(false), done(0) {}
+
+      const size_t count;
+      const std::function<void(size_t)> body;
+      std::atomic<size_t> next;
+      std::atomic<bool> failed;
+      std::mutex mutex;
+      std::condition_variable finished;
+      size_t done;
+      std::exception_ptr error;
+    };
+
+    void runLoop(LoopState& state)
+    {
+      size_t completed = 0;
+      for (size_t i = state.next++; i < state.count; i = state.next++) {
+        // after a failure the remaining iterations are only counted
+        if (!state.failed) {
+          try {
+            state.body(i);
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.error)
+              state.error = std::current_exception();
+            state.failed = true;
+          }
+        }
+        completed++;
+      }
+
+      if (completed > 0) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.done += completed;
+        if (state.done == state.count)
+          state.finished.notify_all();
+      }
+    }
+
+    /**
+     * Lists the CPUs this process may run on, honouring taskset/cgroup masks
+     */
+    std::vector<int> allowedCpus()
+    {
+      std::vector<int> cpus;
+#ifdef __linux__
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+          if (CPU_ISSET(cpu, &mask))
+            cpus.push_back(cpu);
+      }
+#endif
+      return cpus;
+    }
+
+    void pinCurrentThread(int cpu)
+    {
+#ifdef __linux__
+      if (cpu < 0)
+        return;
+      cpu_set_t mask;
+      CPU_ZERO(&mask);
+      CPU_SET(cpu, &mask);
+      pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+#else
+      (void) cpu;
+#endif
+    }
+
+  } // namespace
+
+
+  /**
+   * Starts the worker threads
+   *
+   * @param numThreads total number of threads, including the caller (0 = all available cores)
+   * @param pinThreads pin every worker to its own CPU; the calling thread
+   *        keeps its affinity and is left cpus[0]
+   */
+  ThreadPool::ThreadPool(unsigned int numThreads, bool pinThreads)
+    : m_stopping(false)
+  {
+    if (numThreads == 0)
+      numThreads = availableCores();
+
+    std::vector<int> cpus;
+    if (pinThreads)
+      cpus = allowedCpus();
+
+    for (unsigned int i_worker = 1; i_worker < numThreads; i_worker++) {
+      int cpu = cpus.empty() ? -1 : cpus[i_worker % cpus.size()];
+      m_workers.push_back(std::thread(&ThreadPool::workerLoop, this, cpu));
+    }
+  }
+
+
+  ThreadPool::~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_condition.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); i++)
+      m_workers[i].join();
+  }
+
+
+  /**
+   * Number of threads available to a parallelFor() caller
+   */
+  unsigned int ThreadPool::size() const
+  {
+    return (unsigned int) m_workers.size() + 1;
+  }
+
+
+  /**
+   * Queues a task for the workers. A pool without workers runs it inline.
+   */
+  void ThreadPool::enqueue(const std::function<void()>& task)
+  {
+    if (m_workers.empty()) {
+      task();
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.push(task);
+    }
+    m_condition.notify_one();
+  }
+
+
+  /**
+   * Calls body(i) for every i in [0, count) using the caller and the workers.
+   * Returns once every iteration has finished; the first exception thrown by
+   * body is rethrown in the caller.
+   */
+  void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+  {
+    if (count == 0)
+      return;
+
+    if (m_workers.empty() || count == 1) {
+      for (size_t i = 0; i < count; i++)
+        body(i);
+      return;
+    }
+
+    std::shared_ptr<LoopState> state = std::make_shared<LoopState>(count, body);
+    size_t numHelpers = std::min(count - 1, m_workers.size());
+    for (size_t i_helper = 0; i_helper < numHelpers; i_helper++)
+      enqueue([state]() { runLoop(*state); });
+
+    runLoop(*state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state]() { return state->done == state->count; });
+    if (state->error)
+      std::rethrow_exception(state->error);
+  }
+
+
+  /**
+   * Number of cores this process is allowed to use
+   */
+  unsigned int ThreadPool::availableCores()
+  {
+    size_t numCpus = allowedCpus().size();
+    if (numCpus == 0)
+      numCpus = std::thread::hardware_concurrency();
+    return numCpus > 0 ? (unsigned int) numCpus : 1;
+  }
+
+
+  void ThreadPool::workerLoop(int cpu)
+  {
+    pinCurrentThread(cpu);
+
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+        if (m_stopping && m_tasks.empty())
+          return;
+        task = m_tasks.front();
+        m_tasks.pop();
+      }
+      task();
+    }
+  }
+
+} // namespace GeToIsmrmrd
@@ -0,0 +1,49 @@
+/** @file ThreadPool.h */
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Fixed-size pool of worker threads shared by all conversion stages.
+   *
+   * A pool of size N starts N - 1 workers; the thread that calls
+   * parallelFor() takes part in the loop and is the N-th thread, so the
+   * number of threads busy converting never exceeds the requested count.
+   */
+  class ThreadPool
+  {
+  public:
+    ThreadPool(unsigned int numThreads = 0, bool pinThreads = false);
+    ~ThreadPool();
+
+    unsigned int size() const;
+    void enqueue(const std::function<void()>& task);
+    void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+    static unsigned int availableCores();
+
+  private:
+    ThreadPool(const ThreadPool& other);
+    ThreadPool& operator=(const ThreadPool& other);
+
+    void workerLoop(int cpu);
+
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()> > m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // THREAD_POOL_H
@@ -0,0 +1,635 @@
+
+/** @file WatchService.cpp */
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ISMRMRD
+#include "ismrmrd/dataset.h"
+
+// Local
+#include "Catalog.h"
+#include "DatasetSink.h"
+#include "WatchService.h"
+
+namespace GeToIsmrmrd {
+
+  namespace {
+
+    const uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE;
+
+    std::string realPath(const std::string& path)
+    {
+      char resolved[PATH_MAX];
+      return realpath(path.c_str(), resolved) ? std::string(resolved) : path;
+    }
+
+    /**
+     * Creates the directories leading to a file
+     */
+    void createParentDirectories(const std::string& filepath)
+    {
+      for (size_t slash = filepath.find('/', 1); slash != std::string::npos; slash = filepath.find('/', slash + 1)) {
+        std::string directory = filepath.substr(0, slash);
+        if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST)
+          throw std::runtime_error("Failed to create " + directory + ": " + std::strerror(errno));
+      }
+    }
+
+    /**
+     * Forwards to a DatasetSink and counts the sample bytes written, so the
+     * status report can show the throughput of a running job
+     */
+    class CountingSink : public DatasetSink
+    {
+    public:
+      CountingSink(ISMRMRD::Dataset& d, std::atomic<long long>& bytesWritten)
+        : DatasetSink(d), m_bytesWritten(bytesWritten) {}
+
+      void onNoise(const std::string& name, const ISMRMRD::NDArray<float>& values)
+      {
+        DatasetSink::onNoise(name, values);
+        m_bytesWritten += values.getNumberOfElements() * sizeof(float);
+      }
+
+      void onAcquisition(const ISMRMRD::Acquisition& acq)
+      {
+        DatasetSink::onAcquisition(acq);
+        m_bytesWritten += (long long) acq.getHead().number_of_samples * acq.getHead().active_channels
+          * sizeof(std::complex<float>);
+      }
+
+      void onImage(const std::string& name, const ISMRMRD::Image<std::complex<float> >& image)
+      {
+        DatasetSink::onImage(name, image);
+        m_bytesWritten += image.getNumberOfDataElements() * sizeof(std::complex<float>);
+      }
+
+      void onImage(const std::string& name, const ISMRMRD::Image<short>& image)
+      {
+        DatasetSink::onImage(name, image);
+        m_bytesWritten += image.getNumberOfDataElements() * sizeof(short);
+      }
+
+      void onImage(const std::string& name, const ISMRMRD::Image<int>& image)
+      {
+        DatasetSink::onImage(name, image);
+        m_bytesWritten += image.getNumberOfDataElements() * sizeof(int);
+      }
+
+      void onArray(const std::string& name, const ISMRMRD::NDArray<std::complex<float> >& array)
+      {
+        DatasetSink::onArray(name, array);
+        m_bytesWritten += array.getNumberOfElements() * sizeof(std::complex<float>);
+      }
+
+    private:
+      std::atomic<long long>& m_bytesWritten;
+    };
+
+    double seconds(std::chrono::steady_clock::duration duration)
+    {
+      return std::chrono::duration_cast<std::chrono::duration<double> >(duration).count();
+    }
+
+    const char* stateName(int state)
+    {
+      static const char* const NAMES[] = {"queued", "active", "done", "failed"};
+      return NAMES[state];
+    }
+
+  } // namespace
+
+
+  /**
+   * @param outputDirectory directory the ISMRMRD files are written to
+   * @param threadPool pool shared by all conversions
+   * @param numJobs number of files converted at the same time
+   */
+  WatchService::WatchService(const std::string& outputDirectory, std::shared_ptr<ThreadPool> threadPool,
+                             unsigned int numJobs, bool logging)
+    : m_outputDirectory(outputDirectory),
+      m_anonString(""),
+      m_threadPool(threadPool),
+      m_numJobs(numJobs > 0 ? numJobs : 1),
+      m_inotifyFd(-1),
+      m_statusFd(-1),
+      m_numCompleted(0),
+      m_numFailed(0),
+      m_stopping(false),
+      m_log(logging)
+  {
+    if ((m_inotifyFd = inotify_init1(IN_CLOEXEC)) < 0)
+      throw std::runtime_error(std::string("Failed to initialize inotify: ") + std::strerror(errno));
+
+    // every job writes an ISMRMRD file and may read a ScanArchive
+    if (m_numJobs > 1 && !hdf5ThreadSafe()) {
+      m_log << "HDF5 is not thread-safe, converting one file at a time" << std::endl;
+      m_numJobs = 1;
+    }
+  }
+
+
+  WatchService::~WatchService()
+  {
+    if (m_statusFd >= 0) {
+      close(m_statusFd);
+      unlink(m_socketPath.c_str());
+    }
+    close(m_inotifyFd);
+  }
+
+
+  /**
+   * Specify string to anonymize the converted files
+   */
+  void WatchService::setAnonString(const std::string anonString)
+  {
+    m_anonString.assign(anonString);
+  }
+
+
+  /**
+   * Serve the status report on a Unix socket; an existing socket file is replaced
+   */
+  void WatchService::setStatusSocket(const std::string& socketPath)
+  {
+    struct sockaddr_un address;
+    if (socketPath.size() >= sizeof(address.sun_path))
+      throw std::runtime_error("Status socket path is too long: " + socketPath);
+
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+      throw std::runtime_error(std::string("Failed to create status socket: ") + std::strerror(errno));
+
+    unlink(socketPath.c_str());
+    if (bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 8) != 0) {
+      std::string error = std::strerror(errno);
+      close(fd);
+      throw std::runtime_error("Failed to listen on " + socketPath + ": " + error);
+    }
+
+    m_statusFd = fd;
+    m_socketPath = socketPath;
+  }
+
+
+  /**
+   * Watches a directory and its subdirectories. Raw files already present
+   * that have not been converted yet are picked up, too.
+   *
+   * @throws std::runtime_error if the directory is the output directory
+   */
+  void WatchService::watch(const std::string& directory)
+  {
+    std::string root = directory;
+    while (root.size() > 1 && root[root.size() - 1] == '/')
+      root.erase(root.size() - 1);
+
+    // the outputs would land among the raw files, so nothing there is watched
+    if (realPath(root) == realPath(m_outputDirectory))
+      throw std::runtime_error("Output directory " + m_outputDirectory + " is the watched directory " + root
+                               + "; write the output elsewhere or to a subdirectory");
+
+    m_roots.push_back(root);
+    addWatch(root);
+  }
+
+
+  /**
+   * Converts files as they arrive until SIGINT or SIGTERM. Running jobs are
+   * finished before returning; queued files are left for the next start.
+   */
+  void WatchService::run()
+  {
+    // block the stop signals before the workers start, so they inherit the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    int signalFd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (signalFd < 0)
+      throw std::runtime_error(std::string("Failed to create signal descriptor: ") + std::strerror(errno));
+
+    // a status client that disconnects early must not end the service
+    signal(SIGPIPE, SIG_IGN);
+
+    m_log << "Watching " << m_watches.size() << " directories with " << m_numJobs << " jobs" << std::endl;
+    for (unsigned int i_job = 0; i_job < m_numJobs; i_job++)
+      m_workers.push_back(std::thread(&WatchService::workerLoop, this));
+
+    for (;;) {
+      struct pollfd fds[3] = {
+        {signalFd, POLLIN, 0},
+        {m_inotifyFd, POLLIN, 0},
+        {m_statusFd, POLLIN, 0}
+      };
+      int ready = poll(fds, m_statusFd >= 0 ? 3 : 2, 1000);
+      if (ready < 0 && errno != EINTR)
+        break;
+
+      if (ready > 0 && (fds[0].revents & POLLIN))
+        break;
+      if (ready > 0 && (fds[1].revents & POLLIN))
+        readEvents();
+      if (ready > 0 && m_statusFd >= 0 && (fds[2].revents & POLLIN))
+        serveStatus();
+
+      queueSettled();
+    }
+
+    m_log << "Stopping, waiting for active jobs..." << std::endl;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_wakeup.notify_all();
+    for (size_t i = 0; i < m_workers.size(); i++)
+      m_workers[i].join();
+    m_workers.clear();
+
+    close(signalFd);
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+  }
+
+
+  /**
+   * Queue depth, totals and one tab-separated row per active, queued and
+   * recently finished job
+   */
+  std::string WatchService::status() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Clock::time_point now = Clock::now();
+
+    size_t numActive = 0;
+    for (std::list<std::shared_ptr<Job> >::const_iterator it = m_jobs.begin(); it != m_jobs.end(); ++it)
+      if ((*it)->state == Job::ACTIVE)
+        numActive++;
+
+    std::ostringstream str;
+    str << "queued\t" << m_queue.size() << "\n"
+        << "settling\t" << m_pending.size() << "\n"
+        << "active\t" << numActive << "\n"
+        << "completed\t" << m_numCompleted << "\n"
+        << "failed\t" << m_numFailed << "\n"
+        << "\n"
+        << "state\tpath\tinput_bytes\tbytes_written\tseconds\tMB_per_s\terror\n";
+
+    str << std::fixed << std::setprecision(1);
+    for (std::list<std::shared_ptr<Job> >::const_iterator it = m_jobs.begin(); it != m_jobs.end(); ++it) {
+      const Job& job = **it;
+      double elapsed = 0;
+      if (job.state == Job::ACTIVE)
+        elapsed = seconds(now - job.started);
+      else if (job.state != Job::QUEUED)
+        elapsed = seconds(job.finished - job.started);
+
+      long long bytesWritten = job.bytesWritten;
+      str << stateName(job.state) << "\t" << job.path << "\t" << job.inputBytes << "\t"
+          << bytesWritten << "\t" << elapsed << "\t"
+          << (elapsed > 0 ? bytesWritten / elapsed / 1e6 : 0.0) << "\t" << job.error << "\n";
+    }
+    return str.str();
+  }
+
+
+  void WatchService::addWatch(const std::string& directory)
+  {
+    // our own output is not picked up again
+    if (realPath(directory) == realPath(m_outputDirectory))
+      return;
+
+    int wd = inotify_add_watch(m_inotifyFd, directory.c_str(), WATCH_EVENTS);
+    if (wd < 0) {
+      m_log << "Cannot watch " << directory << ": " << std::strerror(errno) << std::endl;
+      return;
+    }
+    m_watches[wd] = directory;
+
+    // files that arrived before the watch was in place
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+      return;
+    while (struct dirent* entry = readdir(dir)) {
+      std::string name(entry->d_name);
+      if (name == "." || name == "..")
+        continue;
+
+      std::string path = directory + "/" + name;
+      struct stat info;
+      if (lstat(path.c_str(), &info) != 0)
+        continue;
+      if (S_ISDIR(info.st_mode))
+        addWatch(path);
+      else if (S_ISREG(info.st_mode) && !isConverted(path))
+        notice(path);
+    }
+    closedir(dir);
+  }
+
+
+  /**
+   * Starts or restarts the settle period of a raw file
+   */
+  void WatchService::notice(const std::string& filepath)
+  {
+    if (!Catalog::isRawFile(filepath))
+      return;
+
+    struct stat info;
+    if (stat(filepath.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+      return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    PendingFile& file = m_pending[filepath];
+    file.size = info.st_size;
+    file.mtime = info.st_mtime;
+    file.lastChange = Clock::now();
+  }
+
+
+  /**
+   * Restarts the settle period of a raw file that is already pending, e.g.
+   * when a closed file is opened and written again
+   */
+  void WatchService::touch(const std::string& filepath)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<std::string, PendingFile>::iterator it = m_pending.find(filepath);
+    if (it != m_pending.end())
+      it->second.lastChange = Clock::now();
+  }
+
+
+  void WatchService::readEvents()
+  {
+    // aligned as required for struct inotify_event
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length = read(m_inotifyFd, buffer, sizeof(buffer));
+    if (length <= 0)
+      return;
+
+    for (char* p = buffer; p < buffer + length; ) {
+      const struct inotify_event* event = (const struct inotify_event*) p;
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        m_log << "inotify queue overflowed, some files may only be picked up on restart" << std::endl;
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        m_watches.erase(event->wd);
+        continue;
+      }
+
+      std::map<int, std::string>::const_iterator watch = m_watches.find(event->wd);
+      if (watch == m_watches.end() || event->len == 0)
+        continue;
+
+      std::string path = watch->second + "/" + event->name;
+      if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+          addWatch(path);
+      }
+      else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        notice(path);
+      }
+      else if (event->mask & IN_MODIFY) {
+        // a file still being written is not queued before it is closed
+        touch(path);
+      }
+    }
+  }
+
+
+  /**
+   * Queues the files that have stopped changing
+   */
+  void WatchService::queueSettled()
+  {
+    Clock::time_point now = Clock::now();
+    std::vector<std::shared_ptr<Job> > settled;
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      std::map<std::string, PendingFile>::iterator it = m_pending.begin();
+      while (it != m_pending.end()) {
+        struct stat info;
+        if (stat(it->first.c_str(), &info) != 0) {
+          m_pending.erase(it++);
+          continue;
+        }
+
+        if (info.st_size != it->second.size || info.st_mtime != it->second.mtime) {
+          it->second.size = info.st_size;
+          it->second.mtime = info.st_mtime;
+          it->second.lastChange = now;
+        }
+        else if (now - it->second.lastChange >= std::chrono::seconds(SETTLE_SECONDS)
+                 && m_scheduled.count(it->first) == 0) {
+          std::shared_ptr<Job> job = std::make_shared<Job>();
+          job->path = it->first;
+          job->inputBytes = info.st_size;
+          job->state = Job::QUEUED;
+          job->queued = now;
+          job->bytesWritten = 0;
+          settled.push_back(job);
+          m_pending.erase(it++);
+          continue;
+        }
+        ++it;
+      }
+
+      for (size_t i = 0; i < settled.size(); i++) {
+        m_queue.push_back(settled[i]);
+        m_jobs.push_back(settled[i]);
+        m_scheduled.insert(settled[i]->path);
+      }
+    }
+
+    for (size_t i = 0; i < settled.size(); i++)
+      m_wakeup.notify_one();
+  }
+
+
+  void WatchService::serveStatus()
+  {
+    int client = accept4(m_statusFd, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0)
+      return;
+
+    std::string report = status();
+    for (size_t sent = 0; sent < report.size(); ) {
+      ssize_t n = send(client, report.data() + sent, report.size() - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      sent += n;
+    }
+    close(client);
+  }
+
+
+  void WatchService::workerLoop()
+  {
+    for (;;) {
+      std::shared_ptr<Job> job;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wakeup.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+        if (m_stopping)
+          return;
+        job = m_queue.front();
+        m_queue.pop_front();
+        job->state = Job::ACTIVE;
+        job->started = Clock::now();
+      }
+
+      std::string error;
+      try {
+        convert(*job);
+      } catch (const std::exception& e) {
+        error = e.what();
+      }
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      job->finished = Clock::now();
+      job->state = error.empty() ? Job::DONE : Job::FAILED;
+      job->error = error;
+      m_scheduled.erase(job->path);
+      if (error.empty()) {
+        m_numCompleted++;
+        m_log << "Converted " << job->path << " in " << seconds(job->finished - job->started)
+              << " s" << std::endl;
+      }
+      else {
+        m_numFailed++;
+        std::cerr << "Failed to convert " << job->path << ": " << error << std::endl;
+      }
+
+      // keep the active and queued jobs and the most recent finished ones
+      size_t numFinished = 0;
+      for (std::list<std::shared_ptr<Job> >::reverse_iterator it = m_jobs.rbegin(); it != m_jobs.rend(); ) {
+        bool finished = (*it)->state == Job::DONE || (*it)->state == Job::FAILED;
+        if (finished && ++numFinished > STATUS_HISTORY)
+          it = std::list<std::shared_ptr<Job> >::reverse_iterator(m_jobs.erase(std::next(it).base()));
+        else
+          ++it;
+      }
+    }
+  }
+
+
+  /**
+   * Converts one raw file into a temporary file that is renamed into place
+   */
+  void WatchService::convert(Job& job)
+  {
+    std::string finalPath = outputPath(job.path);
+    std::string tmpPath = finalPath + ".part";
+    createParentDirectories(finalPath);
+
+    try {
+      GERawConverter converter(job.path);
+      converter.setThreadPool(m_threadPool);
+      converter.setAnonString(m_anonString);
+
+      std::string xml_header = converter.getIsmrmrdXMLHeader();
+      if (xml_header.empty())
+        throw std::runtime_error("Empty ISMRMRD XML header");
+
+      {
+        ISMRMRD::Dataset d(tmpPath.c_str(), "dataset", true);
+        CountingSink sink(d, job.bytesWritten);
+        sink.onHeader(xml_header);
+        converter.appendNoiseInformation(sink);
+        converter.appendAcquisitions(sink);
+        sink.onComplete();
+      }
+
+      if (std::rename(tmpPath.c_str(), finalPath.c_str()) != 0)
+        throw std::runtime_error("Failed to rename " + tmpPath + " to " + finalPath);
+    } catch (...) {
+      unlink(tmpPath.c_str());
+      throw;
+    }
+  }
+
+
+  /**
+   * Path of a file relative to the innermost watched directory it is in
+   */
+  std::string WatchService::relativePath(const std::string& filepath) const
+  {
+    size_t rootLength = 0;
+    for (size_t i = 0; i < m_roots.size(); i++) {
+      const std::string& root = m_roots[i];
+      if (root.size() > rootLength && filepath.size() > root.size() + 1
+          && filepath.compare(0, root.size(), root) == 0 && filepath[root.size()] == '/')
+        rootLength = root.size();
+    }
+    if (rootLength > 0)
+      return filepath.substr(rootLength + 1);
+
+    size_t slash = filepath.find_last_of('/');
+    return (slash == std::string::npos) ? filepath : filepath.substr(slash + 1);
+  }
+
+
+  /**
+   * sub/P12345.7 is written to sub/P12345.h5 under the output directory, so
+   * recycled P-file numbers in different directories do not collide; a
+   * ScanArchive, which is already named .h5, gets an _ismrmrd suffix
+   */
+  std::string WatchService::outputPath(const std::string& filepath) const
+  {
+    std::string relative = relativePath(filepath);
+    size_t slash = relative.find_last_of('/');
+    std::string directory = (slash == std::string::npos) ? "" : relative.substr(0, slash + 1);
+    std::string name = (slash == std::string::npos) ? relative : relative.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    std::string stem = (dot == std::string::npos) ? name : name.substr(0, dot);
+
+    std::string output = stem + ".h5";
+    if (output == name)
+      output = stem + "_ismrmrd.h5";
+    return m_outputDirectory + "/" + directory + output;
+  }
+
+
+  /**
+   * True if the output exists and is not older than the raw file
+   */
+  bool WatchService::isConverted(const std::string& filepath) const
+  {
+    struct stat input, output;
+    return stat(filepath.c_str(), &input) == 0
+      && stat(outputPath(filepath).c_str(), &output) == 0
+      && output.st_mtime >= input.st_mtime;
+  }
+
+} // namespace GeToIsmrmrd
@@ -0,0 +1,125 @@
+/** @file WatchService.h */
+#ifndef WATCH_SERVICE_H
+#define WATCH_SERVICE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Local
+#include "GERawConverter.h"
+#include "ThreadPool.h"
+
+namespace GeToIsmrmrd {
+
+  /**
+   * Long-running conversion service for directories that a scanner drops
+   * raw files into.
+   *
+   * The directories are watched recursively with inotify. A new or changed
+   * raw file is converted once it has been closed or moved in and its size
+   * and modification time have stayed unchanged for SETTLE_SECONDS; writes
+   * to a file that is not closed yet never queue it. Raw files present at
+   * start are treated as closed. Up to numJobs files are converted at a
+   * time, or one when HDF5 is not thread-safe; all conversions share one
+   * thread pool. The output is written under the output directory at the
+   * input's path relative to its watched directory, first under a
+   * temporary name that is renamed into place when complete.
+   *
+   * An optional Unix socket reports the queue depth and, for every active
+   * and recent job, the bytes written and the throughput to whoever
+   * connects (e.g. `socat - UNIX-CONNECT:<socket>`).
+   */
+  class WatchService
+  {
+  public:
+    WatchService(const std::string& outputDirectory, std::shared_ptr<ThreadPool> threadPool,
+                 unsigned int numJobs, bool logging=false);
+    ~WatchService();
+
+    void setAnonString(const std::string anonString);
+    void setStatusSocket(const std::string& socketPath);
+    void watch(const std::string& directory);
+    void run();
+
+    std::string status() const;
+
+    /** Seconds a file must stay unchanged before it is converted */
+    static const int SETTLE_SECONDS = 2;
+    /** Finished jobs kept for the status report */
+    static const size_t STATUS_HISTORY = 32;
+
+  private:
+    WatchService(const WatchService& other);
+    WatchService& operator=(const WatchService& other);
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job {
+      enum State { QUEUED, ACTIVE, DONE, FAILED };
+
+      std::string path;
+      long long inputBytes;
+      State state;
+      Clock::time_point queued;
+      Clock::time_point started;
+      Clock::time_point finished;
+      std::atomic<long long> bytesWritten;
+      std::string error;
+    };
+
+    struct PendingFile {
+      long long size;
+      long long mtime;
+      Clock::time_point lastChange;
+    };
+
+    void addWatch(const std::string& directory);
+    void notice(const std::string& filepath);
+    void touch(const std::string& filepath);
+    void readEvents();
+    void queueSettled();
+    void serveStatus();
+    void workerLoop();
+    void convert(Job& job);
+    std::string relativePath(const std::string& filepath) const;
+    std::string outputPath(const std::string& filepath) const;
+    bool isConverted(const std::string& filepath) const;
+
+    std::string m_outputDirectory;
+    std::string m_anonString;
+    std::string m_socketPath;
+    std::shared_ptr<ThreadPool> m_threadPool;
+    unsigned int m_numJobs;
+
+    int m_inotifyFd;
+    int m_statusFd;
+    std::vector<std::string> m_roots;
+    std::map<int, std::string> m_watches;
+    std::map<std::string, PendingFile> m_pending;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::deque<std::shared_ptr<Job> > m_queue;
+    std::list<std::shared_ptr<Job> > m_jobs;
+    std::set<std::string> m_scheduled;
+    std::vector<std::thread> m_workers;
+    size_t m_numCompleted;
+    size_t m_numFailed;
+    bool m_stopping;
+
+    logstream m_log;
+  };
+
+} // namespace GeToIsmrmrd
+
+#endif  // WATCH_SERVICE_H
@@ -1,4 +1,5 @@
 #include <cstdio>
+#include <limits>
 
 // Boost
 #include <boost/program_options.hpp>
@@ -12,7 +13,14 @@
 #include <System/Utilities/Main.h>
 
 // GE
+#include "Catalog.h"
+#include "DatasetSink.h"
+#include "FanOutSink.h"
 #include "GERawConverter.h"
+#include "HeaderRewrite.h"
+#include "Preview.h"
+#include "StreamInput.h"
+#include "WatchService.h"
 
 namespace po = boost::program_options;
 
@@ -20,24 +28,50 @@ int main (int argc, char *argv[])
 {
   std::string bin_name = "ge_to_ismrmrd";
 
-  std::string inputFileName, outputFileName, anonString;
+  std::string inputFileName, anonString, previewFileName;
+  std::vector<std::string> outputFileNames;
+  std::vector<std::string> catalogDirectories, watchDirectories, rewriteFileNames;
+  std::string statusSocket;
+  unsigned int numThreads = 0, numJobs = 0;
+  float qaSigma = 0;
+  size_t qaMaxOutliers = 0;
   std::string usage(bin_name + " [options] <input file>");
 
   po::options_description basic("Basic Options");
   basic.add_options()
     ("help,h", "print help message")
     ("verbose", "enable verbose mode")
-    ("output,o", po::value<std::string>(&outputFileName)->default_value("output.h5"), "output HDF5 file")
+    ("output,o", po::value<std::vector<std::string> >(&outputFileNames)->composing()
+     ->default_value(std::vector<std::string>(1, "output.h5"), "output.h5"),
+     "output HDF5 file (repeatable, written in one pass; .png writes a preview)")
     ("rds,r", "P-File from the RDS client")
     ("string,s", "only print the HDF5 XML header")
     ("headeronly", "save only the HDF5 XML header")
+    ("preview,p", po::value<std::string>(&previewFileName), "only write a low-resolution preview (.png or .h5)")
+    ("catalog", po::value<std::vector<std::string> >(&catalogDirectories)->composing(),
+     "update a catalog (-o, default catalog.tsv) of the raw file headers under a directory (repeatable)")
+    ("rewrite-header", po::value<std::vector<std::string> >(&rewriteFileNames)->composing(),
+     "replace only the XML header of an existing ISMRMRD file: regenerated from the input if given, "
+     "otherwise anonymized with -a (repeatable)")
+    ("watch", po::value<std::vector<std::string> >(&watchDirectories)->composing(),
+     "run as a service converting raw files arriving under a directory into -o (repeatable)")
+    ("jobs,j", po::value<unsigned int>(&numJobs)->default_value(2), "files converted at the same time (--watch)")
+    ("status-socket", po::value<std::string>(&statusSocket), "Unix socket reporting queue depth and throughput (--watch)")
+    ("hybrid", "inverse Fourier transform the readout during conversion (x-ky-kz hybrid space)")
+    ("qa", "write per-channel, per-slice QA statistics (qa_mean, qa_variance, qa_max, qa_outliers)")
+    ("qa-sigma", po::value<float>(&qaSigma)->default_value(10.0f), "QA outlier threshold in multiples of rec_std")
+    ("qa-max-outliers", po::value<size_t>(&qaMaxOutliers), "fail when a channel and slice has more QA outliers (implies --qa)")
+    ("sparse", "store only the acquired views of dense P-file k-space, as acquisitions")
+    ("native", "keep integer k-space samples instead of converting to complex float (P-files)")
     ("anon,a", po::value<std::string>(&anonString)->default_value(""), "anon string")
+    ("threads,t", po::value<unsigned int>(&numThreads)->default_value(0), "number of threads (0 = all available cores)")
+    ("pin-threads", "pin each worker thread to its own core")
     ("version", "print version information")
     ;
 
   po::options_description input("Input Options");
   input.add_options()
-    ("input,i", po::value<std::string>(&inputFileName), "input file (PFile or ScanArchive)")
+    ("input,i", po::value<std::string>(&inputFileName), "input file (PFile or ScanArchive), FIFO, or - for stdin")
     ;
 
   po::options_description all_options("Options");
@@ -76,11 +110,78 @@ int main (int argc, char *argv[])
     return EXIT_SUCCESS;
   }
 
+  if (vm.count("catalog")) {
+    std::string catalogFileName = vm["output"].defaulted() ? "catalog.tsv" : outputFileNames[0];
+
+    // Initialize GE functionality
+    GESystem::Main(argc, argv);
+
+    try {
+      GeToIsmrmrd::Catalog catalog(catalogFileName,
+        std::make_shared<GeToIsmrmrd::ThreadPool>(numThreads, vm.count("pin-threads") > 0), vm.count("verbose") > 0);
+      catalog.setAnonString(anonString);
+      catalog.update(catalogDirectories);
+    } catch (const std::exception& e) {
+      std::cerr << "Failed to update catalog: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  if (vm.count("watch")) {
+    std::string outputDirectory = vm["output"].defaulted() ? "." : outputFileNames[0];
+
+    // Initialize GE functionality once for all files
+    GESystem::Main(argc, argv);
+
+    try {
+      GeToIsmrmrd::WatchService service(outputDirectory,
+        std::make_shared<GeToIsmrmrd::ThreadPool>(numThreads, vm.count("pin-threads") > 0),
+        numJobs, vm.count("verbose") > 0);
+      service.setAnonString(anonString);
+      if (statusSocket.size() > 0)
+        service.setStatusSocket(statusSocket);
+      for (size_t i = 0; i < watchDirectories.size(); i++)
+        service.watch(watchDirectories[i]);
+      service.run();
+    } catch (const std::exception& e) {
+      std::cerr << "Watch service failed: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
+
+  // without an input file the headers already in the files are patched
+  if (vm.count("rewrite-header") && inputFileName.size() == 0) {
+    int status = EXIT_SUCCESS;
+    for (size_t i = 0; i < rewriteFileNames.size(); i++) {
+      try {
+        GeToIsmrmrd::rewriteHeader(rewriteFileNames[i], anonString);
+      } catch (const std::exception& e) {
+        std::cerr << "Failed to rewrite header of " << rewriteFileNames[i] << ": " << e.what() << std::endl;
+        status = EXIT_FAILURE;
+      }
+    }
+    return status;
+  }
+
   if (inputFileName.size() == 0) {
     std::cerr << usage << std::endl << visible_options << std::endl;
     return EXIT_FAILURE;
   }
 
+  // a preview needs complex float k-space with encoding indices, which
+  // --native, --hybrid and RDS P-files do not deliver
+  for (size_t i = 0; i < outputFileNames.size(); i++) {
+    const std::string& name = outputFileNames[i];
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".png") == 0
+        && (vm.count("native") || vm.count("hybrid") || vm.count("rds"))) {
+      std::cerr << "ERROR: a .png output cannot be combined with --native, --hybrid or --rds" << std::endl << std::endl;
+      std::cerr << usage << std::endl << visible_options << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
   bool isRDS = false;
   if (vm.count("rds")) {
     isRDS = true;
@@ -99,6 +200,18 @@ int main (int argc, char *argv[])
   // Initialize GE functionality
   GESystem::Main(argc, argv);
 
+  // Copy stdin ("-") or a FIFO into memory; the converter opens the copy
+  std::shared_ptr<GeToIsmrmrd::StreamInput> streamInput;
+  if (GeToIsmrmrd::StreamInput::isStream(inputFileName)) {
+    try {
+      streamInput = std::make_shared<GeToIsmrmrd::StreamInput>(inputFileName, verbose);
+      inputFileName = streamInput->path();
+    } catch (const std::exception& e) {
+      std::cerr << "Failed to read input stream: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
   // Create a new Converter
   std::shared_ptr<GeToIsmrmrd::GERawConverter> converter;
   try {
@@ -109,7 +222,14 @@ int main (int argc, char *argv[])
   }
 
   converter->setRDS(isRDS);
+  converter->setThreadPool(std::make_shared<GeToIsmrmrd::ThreadPool>(numThreads, vm.count("pin-threads") > 0));
   converter->setAnonString(anonString);
+  converter->setNativeSamples(vm.count("native") > 0);
+  converter->setHybridSpace(vm.count("hybrid") > 0);
+  converter->setSparse(vm.count("sparse") > 0);
+  if (vm.count("qa") || vm.count("qa-max-outliers"))
+    converter->setQaStatistics(qaSigma,
+      vm.count("qa-max-outliers") ? qaMaxOutliers : std::numeric_limits<size_t>::max());
 
   // Get the ISMRMRD Header String
   std::string xml_header;
@@ -131,16 +251,79 @@ int main (int argc, char *argv[])
     return EXIT_SUCCESS;
   }
 
-  // create hdf5 file
-  ISMRMRD::Dataset d(outputFileName.c_str(), "dataset", true);
+  // if the user requested a header rewrite, regenerate only the headers of
+  // existing files converted from this input
+  if (vm.count("rewrite-header")) {
+    int status = EXIT_SUCCESS;
+    for (size_t i = 0; i < rewriteFileNames.size(); i++) {
+      try {
+        GeToIsmrmrd::rewriteHeader(rewriteFileNames[i], "", xml_header);
+      } catch (const std::exception& e) {
+        std::cerr << "Failed to rewrite header of " << rewriteFileNames[i] << ": " << e.what() << std::endl;
+        status = EXIT_FAILURE;
+      }
+    }
+    return status;
+  }
+
+  // if the user requested a preview, convert only the central k-space
+  if (vm.count("preview")) {
+    try {
+      GeToIsmrmrd::PreviewSink preview(previewFileName);
+      converter->setViewFilter(GeToIsmrmrd::PREVIEW_VIEWS, GeToIsmrmrd::PREVIEW_SLICES,
+                               GeToIsmrmrd::PREVIEW_PARTITIONS);
+      preview.onHeader(xml_header);
+      converter->appendAcquisitions(preview);
+      preview.onComplete();
+    } catch (const std::exception& e) {
+      std::cerr << "Failed to write preview: " << e.what() << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+  }
 
-  // write the ISMRMRD header to the dataset
-  d.writeHeader(xml_header);
-  // always append noise information, too
-  converter->appendNoiseInformation(d);
-  if (!headerOnly) {
-    // Append data from file
-    converter->appendAcquisitions(d);
+  // create the outputs: hdf5 files, or previews for .png
+  std::vector<std::shared_ptr<ISMRMRD::Dataset> > datasets;
+  std::vector<std::shared_ptr<GeToIsmrmrd::ConversionSink> > outputs;
+  try {
+    for (size_t i = 0; i < outputFileNames.size(); i++) {
+      const std::string& name = outputFileNames[i];
+      if (name.size() > 4 && name.compare(name.size() - 4, 4, ".png") == 0) {
+        outputs.push_back(std::make_shared<GeToIsmrmrd::PreviewSink>(name));
+      }
+      else {
+        datasets.push_back(std::make_shared<ISMRMRD::Dataset>(name.c_str(), "dataset", true));
+        outputs.push_back(std::make_shared<GeToIsmrmrd::DatasetSink>(*datasets.back()));
+      }
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Failed to create output: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // several outputs share one read pass, each written by its own thread
+  GeToIsmrmrd::FanOutSink fanOut;
+  GeToIsmrmrd::ConversionSink* output = outputs[0].get();
+  if (outputs.size() > 1) {
+    for (size_t i = 0; i < outputs.size(); i++)
+      fanOut.addSink(outputs[i]);
+    output = &fanOut;
+  }
+  GeToIsmrmrd::ConversionSink& sink = *output;
+
+  try {
+    // write the ISMRMRD header to the dataset
+    sink.onHeader(xml_header);
+    // always append noise information, too
+    converter->appendNoiseInformation(sink);
+    if (!headerOnly) {
+      // Append data from file
+      converter->appendAcquisitions(sink);
+    }
+    sink.onComplete();
+  } catch (const std::exception& e) {
+    std::cerr << "Failed to convert data: " << e.what() << std::endl;
+    return EXIT_FAILURE;
   }
 
   if (verbose)
@@ -0,0 +1,150 @@
+
+/** @file acquisition_index_test.cpp */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// ISMRMRD
+#include "ismrmrd/ismrmrd.h"
+#include "ismrmrd/dataset.h"
+
+// Local
+#include "AcquisitionIndex.h"
+
+/*
+ * Checks the run grouping of AcquisitionIndex and reading it back from an
+ * ISMRMRD file, including files that were converted into more than once.
+ */
+
+namespace {
+
+  int g_failures = 0;
+
+  void check(bool condition, const char* what)
+  {
+    if (!condition) {
+      std::fprintf(stderr, "FAILED: %s\n", what);
+      g_failures++;
+    }
+  }
+
+
+  ISMRMRD::Acquisition acquisition(uint16_t slice, uint16_t step1)
+  {
+    ISMRMRD::Acquisition acq(4, 1);
+    acq.idx().slice = slice;
+    acq.idx().kspace_encode_step_1 = step1;
+    return acq;
+  }
+
+
+  /** Slice 0 views 0-3, slice 1 views 0-1, then slice 1 view 3 */
+  std::vector<ISMRMRD::Acquisition> acquisitions()
+  {
+    std::vector<ISMRMRD::Acquisition> acqs;
+    for (uint16_t i_view = 0; i_view < 4; i_view++)
+      acqs.push_back(acquisition(0, i_view));
+    acqs.push_back(acquisition(1, 0));
+    acqs.push_back(acquisition(1, 1));
+    acqs.push_back(acquisition(1, 3));
+    return acqs;
+  }
+
+
+  void testRuns()
+  {
+    GeToIsmrmrd::AcquisitionIndex index;
+    std::vector<ISMRMRD::Acquisition> acqs = acquisitions();
+    for (size_t i = 0; i < acqs.size(); i++)
+      index.add(acqs[i].getHead());
+
+    check(index.numRows() == 7, "rows counted");
+    check(index.numRuns() == 3, "consecutive views grouped into runs");
+
+    GeToIsmrmrd::AcquisitionSelection slice1;
+    slice1.slice = 1;
+    std::vector<uint32_t> rows = index.rows(slice1);
+    check(rows.size() == 3 && rows[0] == 4 && rows[1] == 5 && rows[2] == 6, "rows of a slice");
+
+    GeToIsmrmrd::AcquisitionSelection view3;
+    view3.kspace_encode_step_1 = 3;
+    rows = index.rows(view3);
+    check(rows.size() == 2 && rows[0] == 3 && rows[1] == 6, "rows of a view across runs");
+
+    view3.slice = 1;
+    view3.kspace_encode_step_1 = 2;
+    check(index.rows(view3).empty(), "view missing from a run");
+  }
+
+
+  void testLoad(const std::string& path)
+  {
+    std::vector<ISMRMRD::Acquisition> acqs = acquisitions();
+    {
+      ISMRMRD::Dataset d(path.c_str(), "dataset", true);
+      GeToIsmrmrd::AcquisitionIndex index;
+      for (size_t i = 0; i < 4; i++) {
+        d.appendAcquisition(acqs[i]);
+        index.add(acqs[i].getHead());
+      }
+      d.appendNDArray(GeToIsmrmrd::ACQUISITION_INDEX_NAME, index.toArray());
+    }
+
+    {
+      ISMRMRD::Dataset d(path.c_str(), "dataset", false);
+      GeToIsmrmrd::AcquisitionIndex index = GeToIsmrmrd::AcquisitionIndex::load(d);
+      check(index.numRows() == 4 && index.numRuns() == 1, "stored index loaded");
+    }
+
+    // converted into again: the new rows come after the old ones
+    {
+      ISMRMRD::Dataset d(path.c_str(), "dataset", true);
+      for (size_t i = 4; i < acqs.size(); i++)
+        d.appendAcquisition(acqs[i]);
+
+      // the stored index no longer covers every row
+      GeToIsmrmrd::AcquisitionIndex index = GeToIsmrmrd::AcquisitionIndex::load(d);
+      check(index.numRows() == 7 && index.numRuns() == 3, "stale index rebuilt from the acquisitions");
+      d.appendNDArray(GeToIsmrmrd::ACQUISITION_INDEX_NAME, index.toArray());
+    }
+
+    {
+      ISMRMRD::Dataset d(path.c_str(), "dataset", false);
+      check(d.getNumberOfNDArrays(GeToIsmrmrd::ACQUISITION_INDEX_NAME) == 2, "second index appended");
+      GeToIsmrmrd::AcquisitionIndex index = GeToIsmrmrd::AcquisitionIndex::load(d);
+      check(index.numRows() == 7 && index.numRuns() == 3, "last index loaded");
+
+      GeToIsmrmrd::AcquisitionSelection slice1;
+      slice1.slice = 1;
+      std::vector<ISMRMRD::Acquisition> selected;
+      check(index.read(d, slice1, selected) == 3 && selected[2].idx().kspace_encode_step_1 == 3,
+            "selected acquisitions read");
+    }
+  }
+
+} // namespace
+
+
+int main()
+{
+  testRuns();
+
+  char path[] = "/tmp/acquisition_index_test.XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    std::fprintf(stderr, "Failed to create a temporary file\n");
+    return EXIT_FAILURE;
+  }
+  close(fd);
+  unlink(path);
+  testLoad(path);
+  unlink(path);
+
+  if (g_failures > 0)
+    return EXIT_FAILURE;
+  std::printf("acquisition index: all checks passed\n");
+  return EXIT_SUCCESS;
+}